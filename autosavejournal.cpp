@@ -0,0 +1,313 @@
+#include "autosavejournal.h"
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QQueue>
+#include <QSaveFile>
+#include <QThread>
+#include <QWaitCondition>
+#include <QtEndian>
+#include <cstring>
+#include "command.h"
+#include "shapedocument.h"
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+const char journalMagic[4] = { 'S', 'H', 'P', 'J' };
+const int journalHeaderSize = 12;  // магия + поколение снимка
+const int recordHeaderSize = 9;    // операция, id фигуры, длина данных
+const quint8 upsertRecord = 1;
+const quint8 removeRecord = 2;
+const int syncInterval = 500;                  // мс между fsync журнала
+const int compactionInterval = 5 * 60 * 1000;  // мс между снимками
+const int compactionRecordLimit = 100000;
+
+QString snapshotPath(const QString& directory) {
+    return QDir(directory).filePath("autosave.shapes");
+}
+
+QString journalPath(const QString& directory) {
+    return QDir(directory).filePath("autosave.journal");
+}
+
+QByteArray makeRecord(quint8 op, quint32 id, const QByteArray& payload = QByteArray()) {
+    QByteArray record(recordHeaderSize, '\0');
+    uchar* header = reinterpret_cast<uchar*>(record.data());
+    header[0] = op;
+    qToLittleEndian<quint32>(id, header + 1);
+    qToLittleEndian<quint32>(payload.size(), header + 5);
+    record.append(payload);
+    return record;
+}
+
+void syncToDisk(QFile& file) {
+    file.flush();
+#ifdef Q_OS_WIN
+    _commit(file.handle());
+#else
+    ::fsync(file.handle());
+#endif
+}
+}
+
+// Фоновый поток: дописывает записи в журнал и заменяет снимок
+class JournalWriter : public QThread {
+public:
+    explicit JournalWriter(const QString& directory) : directory(directory), stopping(false) {}
+
+    void enqueueRecord(const QByteArray& record) {
+        QMutexLocker locker(&mutex);
+        queue.enqueue({ record, ShapeDocument::Snapshot(), 0, false });
+        wakeUp.wakeOne();
+    }
+
+    // Сериализуется уже в этом потоке
+    void enqueueSnapshot(const ShapeDocument::Snapshot& snapshot, quint64 generation) {
+        QMutexLocker locker(&mutex);
+        queue.enqueue({ QByteArray(), snapshot, generation, true });
+        wakeUp.wakeOne();
+    }
+
+    void stop() {
+        {
+            QMutexLocker locker(&mutex);
+            stopping = true;
+            wakeUp.wakeOne();
+        }
+        wait();
+    }
+
+protected:
+    void run() override {
+        QFile journal(journalPath(directory));
+        QElapsedTimer sinceSync;
+        sinceSync.start();
+        bool dirty = false;
+
+        forever {
+            QQueue<Item> items;
+            bool finishing;
+            {
+                QMutexLocker locker(&mutex);
+                if (queue.isEmpty() && !stopping)
+                    wakeUp.wait(&mutex, syncInterval);
+                items.swap(queue);
+                finishing = stopping;
+            }
+
+            for (const Item& item : items) {
+                if (item.snapshot) {
+                    writeSnapshot(journal, item);
+                } else if (journal.isOpen()) {
+                    journal.write(item.bytes);
+                }
+                dirty = true;
+            }
+
+            // fsync не чаще раза в syncInterval, независимо от числа записей
+            if (dirty && (finishing || sinceSync.hasExpired(syncInterval))) {
+                if (journal.isOpen())
+                    syncToDisk(journal);
+                dirty = false;
+                sinceSync.restart();
+            }
+
+            if (finishing && items.isEmpty())
+                break;
+        }
+    }
+
+private:
+    struct Item {
+        QByteArray bytes;
+        ShapeDocument::Snapshot document;
+        quint64 generation;
+        bool snapshot;
+    };
+
+    void writeSnapshot(QFile& journal, const Item& item) {
+        QSaveFile snapshot(snapshotPath(directory));
+        if (!snapshot.open(QIODevice::WriteOnly))
+            return;
+        snapshot.write(ShapeDocument::serialize(item.document, item.generation));
+        if (!snapshot.commit())
+            return;
+
+        // Новый журнал того же поколения, что и снимок
+        journal.close();
+        if (!journal.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            return;
+        uchar header[journalHeaderSize];
+        std::memcpy(header, journalMagic, sizeof(journalMagic));
+        qToLittleEndian<quint64>(item.generation, header + 4);
+        journal.write(reinterpret_cast<const char*>(header), journalHeaderSize);
+    }
+
+    QString directory;
+    QMutex mutex;
+    QWaitCondition wakeUp;
+    QQueue<Item> queue;
+    bool stopping;
+};
+
+AutosaveJournal::AutosaveJournal(GraphicModel* model, const QString& directory, QObject* parent)
+    : QObject(parent), model(model), directory(directory), writer(nullptr),
+    lastIndex(0), generation(0), recordsSinceCompaction(0), modified(false) {
+    compactionTimer = new QTimer(this);
+    compactionTimer->setInterval(compactionInterval);
+    connect(compactionTimer, &QTimer::timeout, this, &AutosaveJournal::compact);
+}
+
+AutosaveJournal::~AutosaveJournal() {
+    if (writer) {
+        writer->stop();
+        delete writer;
+
+        // Штатное завершение: восстанавливать нечего
+        QFile::remove(snapshotPath(directory));
+        QFile::remove(journalPath(directory));
+    }
+}
+
+bool AutosaveJournal::hasRecoveryData(const QString& directory) {
+    return QFile::exists(snapshotPath(directory));
+}
+
+bool AutosaveJournal::recover(GraphicModel* model, const QString& directory) {
+    quint64 snapshotGeneration;
+    {
+        ShapeDocument snapshot;
+        if (!snapshot.open(snapshotPath(directory)))
+            return false;
+        snapshotGeneration = snapshot.generation();
+    }
+    if (!model->load(snapshotPath(directory)))
+        return false;
+
+    QFile journal(journalPath(directory));
+    if (!journal.open(QIODevice::ReadOnly))
+        return true;
+    const QByteArray bytes = journal.readAll();
+    const uchar* data = reinterpret_cast<const uchar*>(bytes.constData());
+
+    // Журнал другого поколения уже вошел в более новый снимок
+    if (bytes.size() < journalHeaderSize
+        || std::memcmp(data, journalMagic, sizeof(journalMagic)) != 0
+        || qFromLittleEndian<quint64>(data + 4) != snapshotGeneration) {
+        return true;
+    }
+
+    model->beginBatch();
+    int offset = journalHeaderSize;
+    while (offset + recordHeaderSize <= bytes.size()) {
+        const quint8 op = data[offset];
+        const quint32 id = qFromLittleEndian<quint32>(data + offset + 1);
+        const quint32 length = qFromLittleEndian<quint32>(data + offset + 5);
+        if (length > quint32(bytes.size() - offset - recordHeaderSize))
+            break; // Оборванная последняя запись
+
+        model->destroyShape(model->shapeById(id));
+        if (op == upsertRecord) {
+            Shape* shape = ShapeDocument::decodeShape(bytes.mid(offset + recordHeaderSize, length));
+            if (shape)
+                model->addShape(shape);
+        }
+        offset += recordHeaderSize + length;
+    }
+    model->endBatch();
+    model->getUndoStack()->clear();
+    return true;
+}
+
+void AutosaveJournal::start() {
+    if (writer)
+        return;
+
+    QDir().mkpath(directory);
+    // Поколения растут и между запусками, чтобы старый журнал не применился к новому снимку
+    generation = QDateTime::currentMSecsSinceEpoch();
+    writer = new JournalWriter(directory);
+    writer->start(QThread::LowPriority);
+
+    lastIndex = model->getUndoStack()->index();
+    connect(model->getUndoStack(), &QUndoStack::indexChanged,
+            this, &AutosaveJournal::onUndoIndexChanged);
+    connect(model, &GraphicModel::modelReset, this, &AutosaveJournal::onModelReset);
+
+    modified = true;
+    compact();
+    compactionTimer->start();
+}
+
+void AutosaveJournal::compact() {
+    // Без правок со времени прошлого снимка журнал пуст - сжимать нечего
+    if (!writer || !modified)
+        return;
+
+    ++generation;
+    writer->enqueueSnapshot(ShapeDocument::snapshot(model->getShapes()), generation);
+    recordsSinceCompaction = 0;
+    modified = false;
+}
+
+void AutosaveJournal::onModelReset() {
+    modified = true;
+    compact();
+}
+
+void AutosaveJournal::onUndoIndexChanged(int index) {
+    const QUndoStack* stack = model->getUndoStack();
+    QList<Shape*> shapes;
+
+    // redo/push: [lastIndex, index); undo: [index, lastIndex);
+    // тот же индекс - команда слилась с предыдущей (mergeWith)
+    int first = qMin(lastIndex, index);
+    int last = qMax(lastIndex, index);
+    if (first == last)
+        first = index - 1;
+    for (int i = qMax(first, 0); i < last && i < stack->count(); ++i) {
+        collectShapes(stack->command(i), shapes);
+    }
+    lastIndex = index;
+
+    recordShapes(shapes);
+}
+
+void AutosaveJournal::collectShapes(const QUndoCommand* command, QList<Shape*>& shapes) const {
+    const ShapeCommand* shapeCommand = dynamic_cast<const ShapeCommand*>(command);
+    if (shapeCommand)
+        shapes.append(shapeCommand->affectedShapes());
+
+    for (int i = 0; i < command->childCount(); ++i) {
+        collectShapes(command->child(i), shapes);
+    }
+}
+
+void AutosaveJournal::recordShapes(const QList<Shape*>& shapes) {
+    if (!writer)
+        return;
+
+    for (Shape* shape : shapes) {
+        if (shape->getId() == 0)
+            continue;
+        if (model->contains(shape)) {
+            writer->enqueueRecord(makeRecord(upsertRecord, shape->getId(),
+                                             ShapeDocument::encodeShape(shape)));
+        } else {
+            writer->enqueueRecord(makeRecord(removeRecord, shape->getId()));
+        }
+    }
+
+    if (!shapes.isEmpty())
+        modified = true;
+    recordsSinceCompaction += shapes.size();
+    if (recordsSinceCompaction > compactionRecordLimit)
+        compact();
+}
@@ -0,0 +1,45 @@
+#ifndef AUTOSAVEJOURNAL_H
+#define AUTOSAVEJOURNAL_H
+
+#include <QObject>
+#include <QTimer>
+#include "graphicmodel.h"
+
+class JournalWriter;
+
+// Автосохранение документа. Каждая правка превращается в короткую запись
+// журнала (состояние затронутых фигур или их удаление) и ставится в очередь;
+// запись на диск и fsync пачками выполняет фоновый поток. Журнал периодически
+// сжимается в полный снимок: на потоке GUI снимаются только значения фигур,
+// сериализует и пишет их тот же фоновый поток. При штатном завершении файлы удаляются.
+class AutosaveJournal : public QObject {
+    Q_OBJECT
+public:
+    AutosaveJournal(GraphicModel* model, const QString& directory, QObject* parent = nullptr);
+    ~AutosaveJournal();
+
+    static bool hasRecoveryData(const QString& directory);
+    static bool recover(GraphicModel* model, const QString& directory);
+
+    void start();
+    void compact();
+
+private slots:
+    void onUndoIndexChanged(int index);
+    void onModelReset();
+
+private:
+    void collectShapes(const QUndoCommand* command, QList<Shape*>& shapes) const;
+    void recordShapes(const QList<Shape*>& shapes);
+
+    GraphicModel* model;
+    QString directory;
+    JournalWriter* writer;
+    QTimer* compactionTimer;
+    int lastIndex;
+    quint64 generation;
+    int recordsSinceCompaction;
+    bool modified; // Журнал получил записи после последнего снимка
+};
+
+#endif // AUTOSAVEJOURNAL_H
@@ -0,0 +1,310 @@
+#include "batchprocessor.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QFontDatabase>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include "command.h"
+#include "exportrenderer.h"
+#include "graphicmodel.h"
+#include "shapedocument.h"
+
+namespace {
+const QString newDocumentPrefix = QStringLiteral("new:");
+
+bool parseType(const QString& name, ShapeType* type) {
+    static const QHash<QString, ShapeType> types = {
+        { QStringLiteral("line"), ShapeType::Line },
+        { QStringLiteral("rect"), ShapeType::Rectangle },
+        { QStringLiteral("ellipse"), ShapeType::Ellipse },
+        { QStringLiteral("triangle"), ShapeType::Triangle },
+        { QStringLiteral("text"), ShapeType::Text },
+    };
+    auto it = types.constFind(name.toLower());
+    if (it == types.constEnd())
+        return false;
+    *type = it.value();
+    return true;
+}
+
+bool parseNumbers(const QStringList& args, int first, int count, QVector<qreal>& numbers) {
+    if (args.size() < first + count)
+        return false;
+    numbers.clear();
+    for (int i = first; i < first + count; ++i) {
+        bool ok;
+        numbers.append(args.at(i).toDouble(&ok));
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+QString lineError(int line, const QString& error) {
+    return QStringLiteral("line %1: %2").arg(line).arg(error);
+}
+
+// Ошибка записи файла; первой остается ошибка сценария, если она была
+void addOutputError(BatchProcessor::Result& result, const QString& error) {
+    if (!error.isEmpty() && result.ok) {
+        result.ok = false;
+        result.error = error;
+    }
+}
+
+// "all" - все фигуры документа, иначе id фигуры
+QList<Shape*> targetShapes(const GraphicModel* model, const QString& target, bool* ok) {
+    *ok = true;
+    if (target == QLatin1String("all"))
+        return model->getShapes().toList();
+
+    Shape* shape = model->shapeById(target.toUInt(ok));
+    if (!*ok || !model->contains(shape)) {
+        *ok = false;
+        return QList<Shape*>();
+    }
+    return { shape };
+}
+}
+
+BatchProcessor::BatchProcessor() : jobCount(0) {}
+
+bool BatchProcessor::setScript(const QString& fileName, QString* errorString) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+
+    operations.clear();
+    QTextStream stream(&file);
+    for (int line = 1; !stream.atEnd(); ++line) {
+        const QString text = stream.readLine().trimmed();
+        if (text.isEmpty() || text.startsWith(QLatin1Char('#')))
+            continue;
+        QStringList words = text.split(QLatin1Char(' '), Qt::SkipEmptyParts);
+        const QString name = words.takeFirst().toLower();
+        operations.append({ name, words, line });
+    }
+    return true;
+}
+
+void BatchProcessor::setOutputDirectory(const QString& directory) {
+    outputDirectory = directory;
+}
+
+void BatchProcessor::setJobCount(int count) {
+    jobCount = count;
+}
+
+QVector<BatchProcessor::Result> BatchProcessor::run(const QStringList& inputs) const {
+    Q_ASSERT(QThread::currentThread() == QCoreApplication::instance()->thread());
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(jobCount > 0 ? jobCount : QThread::idealThreadCount());
+    // Экспорт раскладывает текст; где шрифты вне GUI-потока не поддерживаются,
+    // файлы пишутся здесь же, сразу после сценария
+    const bool threadedOutput = QFontDatabase::supportsThreadedFontRendering();
+
+    QVector<Result> results;
+    results.reserve(inputs.size());
+    QVector<QPair<int, QFuture<QString>>> writes;
+    for (const QString& input : inputs) {
+        QVector<Output> outputs;
+        results.append(processFile(input, &outputs));
+        if (outputs.isEmpty())
+            continue;
+
+        // Записи одного файла идут в порядке сценария
+        auto write = [outputs]() {
+            for (const Output& output : outputs) {
+                const QString error = output();
+                if (!error.isEmpty())
+                    return error;
+            }
+            return QString();
+        };
+        if (threadedOutput) {
+            writes.append(qMakePair(results.size() - 1, QtConcurrent::run(&pool, write)));
+        } else {
+            addOutputError(results.last(), write());
+        }
+    }
+
+    for (QPair<int, QFuture<QString>>& write : writes) {
+        addOutputError(results[write.first], write.second.result());
+    }
+    return results;
+}
+
+BatchProcessor::Result BatchProcessor::processFile(const QString& input,
+                                                   QVector<Output>* outputs) const {
+    Result result = { input, false, QString() };
+
+    GraphicModel model;
+    QString baseName;
+    if (input.startsWith(newDocumentPrefix)) {
+        baseName = input.mid(newDocumentPrefix.size());
+    } else {
+        baseName = QFileInfo(input).completeBaseName();
+        if (!model.load(input, &result.error))
+            return result;
+    }
+
+    for (const Operation& operation : operations) {
+        QString error;
+        if (!apply(&model, operation, baseName, outputs, &error)) {
+            result.error = lineError(operation.line, error);
+            return result;
+        }
+    }
+    result.ok = true;
+    return result;
+}
+
+bool BatchProcessor::apply(GraphicModel* model, const Operation& operation,
+                           const QString& baseName, QVector<Output>* outputs,
+                           QString* errorString) const {
+    const QStringList& args = operation.args;
+    QVector<qreal> numbers;
+    bool ok = true;
+
+    if (operation.name == QLatin1String("add")) {
+        ShapeType type;
+        if (args.isEmpty() || !parseType(args.first(), &type) || !parseNumbers(args, 1, 4, numbers)) {
+            *errorString = QStringLiteral("expected: add <type> x1 y1 x2 y2 [color] [text]");
+            return false;
+        }
+        const QColor color(args.value(5, QStringLiteral("black")));
+        if (!color.isValid()) {
+            *errorString = QStringLiteral("invalid color %1").arg(args.at(5));
+            return false;
+        }
+        Shape* shape = model->createShape(type, QPointF(numbers[0], numbers[1]), color);
+        if (type == ShapeType::Text) {
+            shape->setText(args.mid(6).join(QLatin1Char(' ')));
+        } else {
+            shape->setEndPos(QPointF(numbers[2], numbers[3]));
+        }
+        model->pushCommand(new AddCommand(model, shape->getId()));
+    } else if (operation.name == QLatin1String("move")) {
+        const QList<Shape*> shapes = targetShapes(model, args.value(0), &ok);
+        if (!ok || !parseNumbers(args, 1, 2, numbers)) {
+            *errorString = QStringLiteral("expected: move <id|all> dx dy");
+            return false;
+        }
+        QVector<QPointF> positions;
+        positions.reserve(shapes.size());
+        for (Shape* shape : shapes) {
+            positions.append(shape->pos());
+        }
+        if (!shapes.isEmpty())
+            model->pushCommand(new MoveShapesCommand(model, shapes, positions,
+                                                     QPointF(numbers[0], numbers[1])));
+    } else if (operation.name == QLatin1String("color")) {
+        const QList<Shape*> shapes = targetShapes(model, args.value(0), &ok);
+        const QColor color(args.value(1));
+        if (!ok || !color.isValid()) {
+            *errorString = QStringLiteral("expected: color <id|all> <color>");
+            return false;
+        }
+        if (!shapes.isEmpty())
+            model->pushCommand(new ColorCommand(model, shapes, color));
+    } else if (operation.name == QLatin1String("delete")) {
+        const QList<Shape*> shapes = targetShapes(model, args.value(0), &ok);
+        if (!ok) {
+            *errorString = QStringLiteral("expected: delete <id|all>");
+            return false;
+        }
+        if (!shapes.isEmpty())
+            model->pushCommand(new DeleteShapesCommand(model, shapes));
+    } else if (operation.name == QLatin1String("undo")) {
+        model->undo();
+    } else if (operation.name == QLatin1String("redo")) {
+        model->getUndoStack()->redo();
+    } else if (operation.name == QLatin1String("save")) {
+        const QString fileName = args.isEmpty()
+            ? QDir(outputDirectory).filePath(baseName + QStringLiteral(".shapes"))
+            : args.first();
+        const ShapeDocument::Snapshot snapshot = ShapeDocument::snapshot(model->getShapes());
+        const int line = operation.line;
+        outputs->append([fileName, snapshot, line]() {
+            QString error;
+            return ShapeDocument::save(fileName, snapshot, &error) ? QString()
+                                                                   : lineError(line, error);
+        });
+    } else if (operation.name == QLatin1String("export")) {
+        const QString format = args.value(0, QStringLiteral("png")).toLower();
+        ExportOptions options;
+        if (args.size() > 1)
+            options.scale = qMax(0.01, args.at(1).toDouble());
+        // Потоки пула уже заняты файлами, растр каждого файла - в одном потоке
+        options.threadCount = 1;
+        const QString fileName = QDir(outputDirectory).filePath(baseName + QLatin1Char('.') + format);
+        const RenderList list = RenderList::snapshot(model->getShapes());
+        const int line = operation.line;
+        outputs->append([list, fileName, options, line]() {
+            QString error;
+            return ExportRenderer::exportToFile(list, fileName, options, &error)
+                ? QString() : lineError(line, error);
+        });
+    } else {
+        *errorString = QStringLiteral("unknown operation %1").arg(operation.name);
+        return false;
+    }
+    return true;
+}
+
+int BatchProcessor::runCommandLine(const QStringList& arguments) {
+    const int index = arguments.indexOf(QStringLiteral("--batch"));
+    if (index < 0 || index + 1 >= arguments.size()) {
+        qWarning("Usage: --batch <script> [--output-dir DIR] [--jobs N] <inputs...>");
+        return 2;
+    }
+
+    BatchProcessor processor;
+    QString error;
+    if (!processor.setScript(arguments.at(index + 1), &error)) {
+        qWarning("%s", qPrintable(error));
+        return 1;
+    }
+
+    processor.setOutputDirectory(QDir::currentPath());
+    QStringList inputs;
+    for (int i = index + 2; i < arguments.size(); ++i) {
+        const QString& argument = arguments.at(i);
+        if (argument == QLatin1String("--output-dir") && i + 1 < arguments.size()) {
+            processor.setOutputDirectory(arguments.at(++i));
+            QDir().mkpath(processor.outputDirectory);
+        } else if (argument == QLatin1String("--jobs") && i + 1 < arguments.size()) {
+            processor.setJobCount(arguments.at(++i).toInt());
+        } else {
+            inputs.append(argument);
+        }
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const QVector<Result> results = processor.run(inputs);
+    const qreal seconds = qMax<qint64>(1, timer.elapsed()) / 1000.0;
+
+    QTextStream out(stdout);
+    int failed = 0;
+    for (const Result& result : results) {
+        if (!result.ok) {
+            ++failed;
+            out << result.input << ": " << result.error << '\n';
+        }
+    }
+    out << QStringLiteral("Processed %1 files (%2 failed) in %3 s, %4 files/s")
+               .arg(results.size()).arg(failed)
+               .arg(seconds, 0, 'f', 2).arg(results.size() / seconds, 0, 'f', 1)
+        << '\n';
+    return failed == 0 ? 0 : 1;
+}
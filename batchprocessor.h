@@ -0,0 +1,67 @@
+#ifndef BATCHPROCESSOR_H
+#define BATCHPROCESSOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <functional>
+
+class GraphicModel;
+
+// Пакетная обработка документов без окна. Каждый файл обрабатывается
+// своей GraphicModel, правки идут через команды из command.h, как и в
+// редакторе. Сцена модели - объект QtWidgets и живет только в GUI-потоке,
+// поэтому сценарии файлов выполняются по очереди в вызывающем потоке.
+// Сохранение и экспорт берут снимок документа и пишут файл в пуле потоков,
+// пока здесь идет сценарий следующего файла. Нужен QApplication с
+// платформой offscreen (сцена и шрифты), но ни одного виджета.
+//
+// Сценарий - текстовый файл, по операции в строке ('#' - комментарий):
+//   add <line|rect|ellipse|triangle|text> x1 y1 x2 y2 [color] [text...]
+//   move <id|all> dx dy
+//   color <id|all> <color>
+//   delete <id|all>
+//   undo | redo
+//   save [file]                  по умолчанию <каталог вывода>/<имя>.shapes
+//   export <png|svg|pdf> [scale] в <каталог вывода>/<имя>.<формат>
+// Вход "new:<имя>" означает пустой документ.
+class BatchProcessor {
+public:
+    struct Result {
+        QString input;
+        bool ok;
+        QString error;
+    };
+
+    BatchProcessor();
+
+    bool setScript(const QString& fileName, QString* errorString = nullptr);
+    void setOutputDirectory(const QString& directory);
+    void setJobCount(int count); // Потоков записи файлов, 0 - по числу ядер
+
+    QVector<Result> run(const QStringList& inputs) const; // Только в GUI-потоке
+
+    //   --batch <script> [--output-dir DIR] [--jobs N] <inputs...>
+    // Печатает итог и пропускную способность в файлах в секунду.
+    static int runCommandLine(const QStringList& arguments);
+
+private:
+    struct Operation {
+        QString name;
+        QStringList args;
+        int line;
+    };
+
+    // Запись файла по снимку документа; возвращает текст ошибки
+    typedef std::function<QString()> Output;
+
+    Result processFile(const QString& input, QVector<Output>* outputs) const;
+    bool apply(GraphicModel* model, const Operation& operation, const QString& baseName,
+               QVector<Output>* outputs, QString* errorString) const;
+
+    QVector<Operation> operations;
+    QString outputDirectory;
+    int jobCount;
+};
+
+#endif // BATCHPROCESSOR_H
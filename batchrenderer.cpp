@@ -0,0 +1,147 @@
+#include "batchrenderer.h"
+#include <QPainter>
+#include "profiler.h"
+
+namespace {
+// Сколько последних пакетов просматривается в поисках подходящего.
+// Дальше поиск не окупается: пакетов обычно столько же, сколько стилей.
+const int maxLookback = 64;
+}
+
+BatchRenderer::BatchRenderer() : shapes(0), antialiasing(true) {}
+
+bool BatchRenderer::accepts(const Shape* shape) {
+    return !shape->isLive() && !shape->isSelected() && !shape->isEditing && shape->isVisible()
+           && shape->sceneTransform().type() <= QTransform::TxTranslate;
+}
+
+void BatchRenderer::build(const QList<QGraphicsItem*>& items, qreal lod) {
+    PROFILE_SCOPE("BatchRenderer::build");
+    clear();
+    antialiasing = !Shape::isLevelOfDetailEnabled() || lod >= Shape::getAntialiasingScale();
+
+    for (QGraphicsItem* item : items) {
+        Shape* shape = dynamic_cast<Shape*>(item);
+        if (!shape || !accepts(shape))
+            continue;
+
+        const Shape::Detail detail = shape->getDetail(lod);
+        if (detail == Shape::Detail::Hidden)
+            continue;
+
+        const QTransform transform = shape->sceneTransform();
+        const QPointF offset(transform.dx(), transform.dy());
+        const QRectF rect = shape->bounds.translated(offset);
+        const ShapeStyle* style = &shape->getStyle();
+
+        if (detail == Shape::Detail::Box) {
+            batchFor(Kind::Boxes, style, rect).rects.append(rect);
+        } else {
+            switch (shape->type) {
+            case ShapeType::Line:
+                batchFor(Kind::Lines, style, rect).lines.append(
+                    QLineF(shape->startPos + offset, shape->endPos + offset));
+                break;
+            case ShapeType::Rectangle:
+                batchFor(Kind::Rectangles, style, rect).rects.append(
+                    QRectF(shape->startPos, shape->endPos).translated(offset));
+                break;
+            case ShapeType::Ellipse:
+                batchFor(Kind::Ellipses, style, rect).rects.append(
+                    QRectF(shape->startPos, shape->endPos).normalized().translated(offset));
+                break;
+            case ShapeType::Triangle:
+                batchFor(Kind::Triangles, style, rect).polygons.append(
+                    shape->triangle.translated(offset));
+                break;
+            case ShapeType::Text:
+                batchFor(Kind::Text, style, rect).texts.append(
+                    { shape->startPos + offset, shape->textData->staticText });
+                break;
+            }
+        }
+        ++shapes;
+        PROFILE_COUNT(ShapesPainted);
+    }
+}
+
+BatchRenderer::Batch& BatchRenderer::batchFor(Kind kind, const ShapeStyle* style, const QRectF& rect) {
+    const int stop = qMax(0, batches.size() - maxLookback);
+    for (int i = batches.size() - 1; i >= stop; --i) {
+        Batch& batch = batches[i];
+        if (batch.kind == kind && batch.style == style) {
+            batch.bounds |= rect;
+            return batch;
+        }
+        // Фигура легла бы под пересекающий ее пакет
+        if (batch.bounds.intersects(rect))
+            break;
+    }
+
+    Batch batch;
+    batch.kind = kind;
+    batch.style = style;
+    batch.bounds = rect;
+    batches.append(batch);
+    return batches.last();
+}
+
+void BatchRenderer::paint(QPainter* painter) const {
+    PROFILE_SCOPE("BatchRenderer::paint");
+    painter->save();
+    if (!antialiasing)
+        painter->setRenderHint(QPainter::Antialiasing, false);
+    painter->setBrush(Qt::NoBrush);
+
+    for (const Batch& batch : batches) {
+        switch (batch.kind) {
+        case Kind::Lines:
+            painter->setPen(batch.style->pen);
+            painter->drawLines(batch.lines);
+            break;
+        case Kind::Rectangles:
+            painter->setPen(batch.style->pen);
+            painter->drawRects(batch.rects);
+            break;
+        case Kind::Ellipses:
+            painter->setPen(batch.style->pen);
+            for (const QRectF& rect : batch.rects) {
+                painter->drawEllipse(rect);
+            }
+            break;
+        case Kind::Triangles:
+            painter->setPen(batch.style->pen);
+            for (const QPolygonF& polygon : batch.polygons) {
+                painter->drawPolygon(polygon);
+            }
+            break;
+        case Kind::Text:
+            painter->setPen(batch.style->pen);
+            painter->setFont(batch.style->font);
+            for (const TextRun& run : batch.texts) {
+                painter->drawStaticText(run.pos, run.text);
+            }
+            break;
+        case Kind::Boxes:
+            painter->setPen(Qt::NoPen);
+            painter->setBrush(batch.style->color);
+            painter->drawRects(batch.rects);
+            painter->setBrush(Qt::NoBrush);
+            break;
+        }
+    }
+    painter->restore();
+}
+
+void BatchRenderer::clear() {
+    batches.clear();
+    shapes = 0;
+}
+
+int BatchRenderer::batchCount() const {
+    return batches.size();
+}
+
+int BatchRenderer::shapeCount() const {
+    return shapes;
+}
@@ -0,0 +1,57 @@
+#ifndef BATCHRENDERER_H
+#define BATCHRENDERER_H
+
+#include <QGraphicsItem>
+#include <QStaticText>
+#include <QVector>
+#include "shape.h"
+
+// Пакетная отрисовка неподвижных фигур. Фигуры одного вида и стиля идут
+// подряд, так что перо и шрифт меняются по разу на пакет, а не на фигуру;
+// линии и прямоугольники рисуются одним drawLines/drawRects. Эллипсы и
+// треугольники рисуются по одному: общий сглаженный контур пришлось бы
+// растеризовать целиком. Фигура присоединяется к более раннему пакету,
+// только если не пересекает пакеты, лежащие между ними, поэтому порядок
+// наложения сохраняется. Готовые пакеты живут до invalidate на сцене.
+class BatchRenderer {
+public:
+    BatchRenderer();
+
+    // Фигура рисуется пакетом, а не своим paint(): неподвижна, не выделена,
+    // не редактируется и сдвинута относительно сцены только переносом
+    static bool accepts(const Shape* shape);
+
+    // items - в порядке наложения снизу вверх, lod - масштаб устройства
+    void build(const QList<QGraphicsItem*>& items, qreal lod);
+    void paint(QPainter* painter) const;
+    void clear();
+
+    int batchCount() const;
+    int shapeCount() const;
+
+private:
+    enum class Kind { Lines, Rectangles, Ellipses, Triangles, Text, Boxes };
+
+    struct TextRun {
+        QPointF pos;
+        QStaticText text; // Неявно общая копия раскладки фигуры
+    };
+
+    struct Batch {
+        Kind kind;
+        const ShapeStyle* style; // Записи StyleTable не перемещаются
+        QRectF bounds;
+        QVector<QLineF> lines;
+        QVector<QRectF> rects; // Прямоугольники, эллипсы и заливки
+        QVector<QPolygonF> polygons;
+        QVector<TextRun> texts;
+    };
+
+    Batch& batchFor(Kind kind, const ShapeStyle* style, const QRectF& rect);
+
+    QVector<Batch> batches;
+    int shapes;
+    bool antialiasing;
+};
+
+#endif // BATCHRENDERER_H
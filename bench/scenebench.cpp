@@ -0,0 +1,688 @@
+// Бенчмарки модели, сцены и истории отмены на 1k/10k/100k фигур.
+// Запускается без окна (по умолчанию платформа offscreen):
+//   scenebench [--json results.json] [аргументы QtTest]
+// С --json результаты QBENCHMARK дополнительно пишутся одним JSON-файлом,
+// который удобно сравнивать между коммитами.
+#include <QApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QTemporaryFile>
+#include <QXmlStreamReader>
+#include <QtMath>
+#include <QtTest>
+#include <limits>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "command.h"
+#include "graphiccontroller.h"
+#include "graphicmodel.h"
+
+namespace {
+const int hitTestPoints = 1000;
+
+// Набор фигур задается числом фигур, чтобы прогоны разных коммитов совпадали
+struct ShapeSpec {
+    ShapeType type;
+    QPointF startPos;
+    QPointF endPos;
+    QColor color;
+    QString text;
+};
+
+// Плотность постоянна: сторона области растет как корень из числа фигур
+qreal extentFor(int count) {
+    return qSqrt(count) * 40;
+}
+
+QVector<ShapeSpec> makeSpecs(int count) {
+    static const ShapeType types[] = {
+        ShapeType::Line, ShapeType::Rectangle, ShapeType::Ellipse, ShapeType::Triangle,
+    };
+    static const QColor colors[] = { Qt::black, Qt::red, Qt::darkGreen, Qt::blue };
+
+    QRandomGenerator random(count);
+    const qreal extent = extentFor(count);
+    QVector<ShapeSpec> specs;
+    specs.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        ShapeSpec spec;
+        // Каждая десятая фигура - надпись
+        spec.type = i % 10 == 9 ? ShapeType::Text : types[random.bounded(4)];
+        spec.startPos = QPointF(random.bounded(extent), random.bounded(extent));
+        spec.endPos = spec.startPos + QPointF(5 + random.bounded(95.0), 5 + random.bounded(95.0));
+        spec.color = colors[random.bounded(4)];
+        if (spec.type == ShapeType::Text)
+            spec.text = QStringLiteral("Label %1").arg(i);
+        specs.append(spec);
+    }
+    return specs;
+}
+
+// Фигура без модели
+Shape* buildShape(const ShapeSpec& spec) {
+    Shape* shape = new Shape(spec.type, spec.startPos, spec.color);
+    if (spec.type == ShapeType::Text) {
+        shape->setText(spec.text);
+    } else {
+        shape->setEndPos(spec.endPos);
+    }
+    return shape;
+}
+
+Shape* createShape(GraphicModel& model, const ShapeSpec& spec) {
+    Shape* shape = buildShape(spec);
+    model.adoptShape(shape);
+    return shape;
+}
+
+// Документ без истории отмены, как после загрузки
+void populate(GraphicModel& model, int count) {
+    QList<Shape*> shapes;
+    shapes.reserve(count);
+    for (const ShapeSpec& spec : makeSpecs(count)) {
+        shapes.append(createShape(model, spec));
+    }
+    model.addShapes(shapes);
+}
+
+QVector<QPointF> makePoints(int count, const QRectF& area) {
+    QRandomGenerator random(count);
+    QVector<QPointF> points;
+    points.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        points.append(QPointF(area.left() + random.bounded(area.width()),
+                              area.top() + random.bounded(area.height())));
+    }
+    return points;
+}
+
+// Наивный JSON для сравнения с двоичным форматом: по массиву на фигуру
+// [тип, x1, y1, x2, y2, x, y, цвет, текст, шрифт]
+QByteArray toJson(const ShapeRange& shapes) {
+    QJsonArray array;
+    for (Shape* shape : shapes) {
+        QJsonArray values;
+        values << static_cast<int>(shape->getType())
+               << shape->getStartPos().x() << shape->getStartPos().y()
+               << shape->getEndPos().x() << shape->getEndPos().y()
+               << shape->pos().x() << shape->pos().y()
+               << shape->getColor().name(QColor::HexArgb);
+        if (shape->getType() == ShapeType::Text)
+            values << shape->getText() << shape->getFont().toString();
+        array.append(values);
+    }
+    return QJsonDocument(array).toJson(QJsonDocument::Compact);
+}
+
+QJsonParseError::ParseError loadJson(GraphicModel& model, const QString& fileName) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return QJsonParseError::IllegalValue;
+
+    QJsonParseError error;
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &error);
+    if (error.error != QJsonParseError::NoError)
+        return error.error;
+
+    const QJsonArray array = document.array();
+    QList<Shape*> loaded;
+    loaded.reserve(array.size());
+    for (const QJsonValue& value : array) {
+        const QJsonArray values = value.toArray();
+        const ShapeType type = static_cast<ShapeType>(values.at(0).toInt());
+        Shape* shape = new Shape(type, QPointF(values.at(1).toDouble(), values.at(2).toDouble()),
+                                 QColor(values.at(7).toString()));
+        if (type == ShapeType::Text) {
+            QFont font;
+            font.fromString(values.at(9).toString());
+            shape->setFont(font);
+            shape->setText(values.at(8).toString());
+        } else {
+            shape->setEndPos(QPointF(values.at(3).toDouble(), values.at(4).toDouble()));
+        }
+        shape->setPos(values.at(5).toDouble(), values.at(6).toDouble());
+        loaded.append(shape);
+    }
+    model.resetShapes(loaded);
+    return QJsonParseError::NoError;
+}
+
+// Поле /proc/self/status в байтах, -1 - нет такого поля
+qint64 processStatus(const QByteArray& field) {
+    QFile status(QStringLiteral("/proc/self/status"));
+    if (!status.open(QIODevice::ReadOnly | QIODevice::Text))
+        return -1;
+    for (QByteArray line = status.readLine(); !line.isEmpty(); line = status.readLine()) {
+        if (line.startsWith(field))
+            return line.mid(field.size()).simplified().split(' ').first().toLongLong() * 1024;
+    }
+    return -1;
+}
+
+// Сбрасывает пик RSS до текущего значения и возвращает это значение
+qint64 resetPeakResidentSize() {
+#ifdef __GLIBC__
+    malloc_trim(0); // Освобожденная куча не должна покрывать новые выделения
+#endif
+    QFile clearRefs(QStringLiteral("/proc/self/clear_refs"));
+    if (!clearRefs.open(QIODevice::WriteOnly) || clearRefs.write("5") != 1)
+        return -1;
+    clearRefs.close();
+    return processStatus("VmRSS:");
+}
+
+// Результаты из XML-журнала QtTest в JSON: по объекту на строку данных
+bool writeJson(const QString& xmlFileName, const QString& jsonFileName) {
+    QFile xmlFile(xmlFileName);
+    if (!xmlFile.open(QIODevice::ReadOnly))
+        return false;
+
+    QJsonArray results;
+    QString function;
+    QXmlStreamReader reader(&xmlFile);
+    while (!reader.atEnd()) {
+        reader.readNext();
+        if (!reader.isStartElement())
+            continue;
+
+        const QXmlStreamAttributes attributes = reader.attributes();
+        if (reader.name() == QLatin1String("TestFunction")) {
+            function = attributes.value(QLatin1String("name")).toString();
+        } else if (reader.name() == QLatin1String("BenchmarkResult")) {
+            QJsonObject result;
+            result.insert(QStringLiteral("benchmark"), function);
+            result.insert(QStringLiteral("tag"), attributes.value(QLatin1String("tag")).toString());
+            result.insert(QStringLiteral("metric"),
+                          attributes.value(QLatin1String("metric")).toString());
+            result.insert(QStringLiteral("value"),
+                          attributes.value(QLatin1String("value")).toDouble());
+            result.insert(QStringLiteral("iterations"),
+                          attributes.value(QLatin1String("iterations")).toInt());
+            results.append(result);
+        }
+    }
+    if (reader.hasError())
+        return false;
+
+    QJsonObject root;
+    root.insert(QStringLiteral("qtVersion"), QString::fromLatin1(qVersion()));
+    root.insert(QStringLiteral("date"), QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    root.insert(QStringLiteral("results"), results);
+
+    QFile jsonFile(jsonFileName);
+    if (!jsonFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    return jsonFile.write(QJsonDocument(root).toJson()) > 0;
+}
+}
+
+class SceneBenchmark : public QObject {
+    Q_OBJECT
+
+private slots:
+    // Вставка по одной фигуре командой AddCommand, как при рисовании
+    void addShape_data() { sizes(); }
+    void addShape();
+    // Пакетная вставка addShapes(), как при загрузке документа
+    void addShapes_data() { sizes(); }
+    void addShapes();
+    // Вся сцена в QImage 1024x1024 через QGraphicsScene::render
+    void render_data() { sizes(); }
+    void render();
+    // scene->items(pos) в случайных точках - так искал фигуру исходный mousePressed
+    void sceneItemsAt_data() { sizes(); }
+    void sceneItemsAt();
+    // Удаление выделенной половины фигур одной командой
+    void deleteSelected_data() { sizes(); }
+    void deleteSelected();
+    // Отмена и повтор всей истории из count команд добавления
+    void undoRedo_data() { sizes(); }
+    void undoRedo();
+    // Обход всех фигур: копия в QList, как возвращал прежний getShapes(),
+    // против ShapeRange без копирования
+    void shapesCopy_data() { sizes(); }
+    void shapesCopy();
+    void shapesRange_data() { sizes(); }
+    void shapesRange();
+    // Выделение (1% фигур) после его изменения: поиск по всем фигурам
+    // против индекса выделения модели
+    void selectedByScan_data() { sizes(); }
+    void selectedByScan();
+    void selectedIndex_data() { sizes(); }
+    void selectedIndex();
+    // 100k фигур в QImage 1024x1024 при разных масштабах, с LOD и без
+    void renderZoomed_data();
+    void renderZoomed();
+    // Открытие документа: двоичный формат (GraphicModel::load) против наивного
+    // JSON с тем же содержимым. Время и пиковый прирост RSS (только Linux)
+    void loadDocument_data() { documentRows(); }
+    void loadDocument();
+    void loadPeakMemory_data() { documentRows(); }
+    void loadPeakMemory();
+    // Память на фигуру при 1M фигур (прирост RSS, только Linux): сами фигуры
+    // и фигуры в модели вместе со сценой и индексами
+    void bytesPerShape_data();
+    void bytesPerShape();
+    // Запросы к пространственному индексу модели (R-дерево и сетка) на
+    // 10k/100k/1M фигур: точка с проверкой формы, прямоугольник рамки
+    // выделения и 10 ближайших. Для сравнения - scene->items(rect) по BSP сцены
+    void indexQuery_data();
+    void indexQuery();
+
+private:
+    void sizes();
+    void documentRows();
+    QString documentFile(int count, bool json);
+
+    QTemporaryDir documents;
+};
+
+void SceneBenchmark::sizes() {
+    QTest::addColumn<int>("count");
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+}
+
+void SceneBenchmark::addShape() {
+    QFETCH(int, count);
+    const QVector<ShapeSpec> specs = makeSpecs(count);
+    GraphicModel model;
+
+    QBENCHMARK_ONCE {
+        for (const ShapeSpec& spec : specs) {
+            Shape* shape = createShape(model, spec);
+            model.pushCommand(new AddCommand(&model, shape->getId()));
+        }
+    }
+    QCOMPARE(model.shapeCount(), count);
+}
+
+void SceneBenchmark::addShapes() {
+    QFETCH(int, count);
+    const QVector<ShapeSpec> specs = makeSpecs(count);
+    GraphicModel model;
+
+    QBENCHMARK_ONCE {
+        QList<Shape*> shapes;
+        shapes.reserve(count);
+        for (const ShapeSpec& spec : specs) {
+            shapes.append(createShape(model, spec));
+        }
+        model.addShapes(shapes);
+    }
+    QCOMPARE(model.shapeCount(), count);
+}
+
+void SceneBenchmark::render() {
+    QFETCH(int, count);
+    GraphicModel model;
+    populate(model, count);
+    CustomGraphicsScene* scene = model.getScene();
+    const QRectF source = scene->itemsBoundingRect();
+    QImage image(1024, 1024, QImage::Format_ARGB32_Premultiplied);
+
+    QBENCHMARK {
+        image.fill(Qt::white);
+        QPainter painter(&image);
+        painter.setRenderHint(QPainter::Antialiasing);
+        scene->render(&painter, QRectF(image.rect()), source);
+    }
+}
+
+void SceneBenchmark::sceneItemsAt() {
+    QFETCH(int, count);
+    GraphicModel model;
+    populate(model, count);
+    CustomGraphicsScene* scene = model.getScene();
+    const QVector<QPointF> points = makePoints(hitTestPoints, scene->itemsBoundingRect());
+
+    int hits = 0;
+    QBENCHMARK {
+        for (const QPointF& pos : points) {
+            hits += scene->items(pos).size();
+        }
+    }
+    Q_UNUSED(hits);
+}
+
+void SceneBenchmark::deleteSelected() {
+    QFETCH(int, count);
+    GraphicModel model;
+    populate(model, count);
+    GraphicController controller(&model);
+    int index = 0;
+    for (Shape* shape : model.getShapes()) {
+        shape->setSelected(index++ % 2 == 0);
+    }
+
+    QBENCHMARK_ONCE {
+        controller.deleteSelectedItems();
+    }
+    QCOMPARE(model.shapeCount(), count / 2);
+}
+
+void SceneBenchmark::undoRedo() {
+    QFETCH(int, count);
+    GraphicModel model;
+    // Бюджет не ограничен: отменяется вся история, а не последние команды
+    model.setHistoryMemoryBudget(std::numeric_limits<qint64>::max());
+    for (const ShapeSpec& spec : makeSpecs(count)) {
+        Shape* shape = createShape(model, spec);
+        model.pushCommand(new AddCommand(&model, shape->getId()));
+    }
+    QUndoStack* stack = model.getUndoStack();
+
+    QBENCHMARK {
+        while (stack->canUndo()) {
+            model.undo();
+        }
+        while (stack->canRedo()) {
+            stack->redo();
+        }
+    }
+    QCOMPARE(model.shapeCount(), count);
+}
+
+void SceneBenchmark::shapesCopy() {
+    QFETCH(int, count);
+    GraphicModel model;
+    populate(model, count);
+
+    quint64 sum = 0;
+    QBENCHMARK {
+        const QList<Shape*> shapes = model.getShapes().toList();
+        for (Shape* shape : shapes) {
+            sum += shape->getId();
+        }
+    }
+    Q_UNUSED(sum);
+}
+
+void SceneBenchmark::shapesRange() {
+    QFETCH(int, count);
+    GraphicModel model;
+    populate(model, count);
+
+    quint64 sum = 0;
+    QBENCHMARK {
+        for (Shape* shape : model.getShapes()) {
+            sum += shape->getId();
+        }
+    }
+    Q_UNUSED(sum);
+}
+
+void SceneBenchmark::selectedByScan() {
+    QFETCH(int, count);
+    GraphicModel model;
+    populate(model, count);
+    const QList<Shape*> shapes = model.getShapes().toList();
+    for (int i = 0; i < shapes.size(); i += 100) {
+        shapes.at(i)->setSelected(true);
+    }
+
+    int selected = 0;
+    QBENCHMARK {
+        // Выделение меняется на каждой итерации, как между щелчками
+        shapes.first()->setSelected(!shapes.first()->isSelected());
+        for (Shape* shape : model.getShapes().toList()) {
+            if (shape->isSelected())
+                ++selected;
+        }
+    }
+    Q_UNUSED(selected);
+}
+
+void SceneBenchmark::selectedIndex() {
+    QFETCH(int, count);
+    GraphicModel model;
+    populate(model, count);
+    const QList<Shape*> shapes = model.getShapes().toList();
+    for (int i = 0; i < shapes.size(); i += 100) {
+        shapes.at(i)->setSelected(true);
+    }
+
+    int selected = 0;
+    QBENCHMARK {
+        shapes.first()->setSelected(!shapes.first()->isSelected());
+        selected += model.getSelectedShapes().size();
+    }
+    Q_UNUSED(selected);
+}
+
+void SceneBenchmark::renderZoomed_data() {
+    QTest::addColumn<qreal>("zoom");
+    QTest::addColumn<bool>("levelOfDetail");
+    for (qreal zoom : { 1.0, 0.25, 0.05 }) {
+        QTest::newRow(qPrintable(QStringLiteral("zoom %1").arg(zoom))) << zoom << false;
+        QTest::newRow(qPrintable(QStringLiteral("zoom %1 lod").arg(zoom))) << zoom << true;
+    }
+}
+
+void SceneBenchmark::renderZoomed() {
+    QFETCH(qreal, zoom);
+    QFETCH(bool, levelOfDetail);
+    GraphicModel model;
+    populate(model, 100000);
+    CustomGraphicsScene* scene = model.getScene();
+    QImage image(1024, 1024, QImage::Format_ARGB32_Premultiplied);
+
+    // Видимая область вокруг центра сцены при заданном масштабе
+    QRectF source(QPointF(), QSizeF(image.size()) / zoom);
+    source.moveCenter(scene->itemsBoundingRect().center());
+
+    const bool wasEnabled = Shape::isLevelOfDetailEnabled();
+    Shape::setLevelOfDetailEnabled(levelOfDetail);
+    QBENCHMARK {
+        image.fill(Qt::white);
+        QPainter painter(&image);
+        painter.setRenderHint(QPainter::Antialiasing);
+        scene->render(&painter, QRectF(image.rect()), source);
+    }
+    Shape::setLevelOfDetailEnabled(wasEnabled);
+}
+
+void SceneBenchmark::documentRows() {
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("json");
+    QTest::newRow("100k binary") << 100000 << false;
+    QTest::newRow("100k json") << 100000 << true;
+    QTest::newRow("1M binary") << 1000000 << false;
+    QTest::newRow("1M json") << 1000000 << true;
+}
+
+QString SceneBenchmark::documentFile(int count, bool json) {
+    const QString fileName = documents.filePath(
+        QStringLiteral("%1.%2").arg(count).arg(json ? QStringLiteral("json") : QStringLiteral("shapes")));
+    if (QFile::exists(fileName))
+        return fileName;
+
+    GraphicModel model;
+    populate(model, count);
+    if (json) {
+        QFile file(fileName);
+        if (file.open(QIODevice::WriteOnly))
+            file.write(toJson(model.getShapes()));
+    } else {
+        model.save(fileName);
+    }
+    return fileName;
+}
+
+void SceneBenchmark::loadDocument() {
+    QFETCH(int, count);
+    QFETCH(bool, json);
+    const QString fileName = documentFile(count, json);
+    GraphicModel model;
+
+    QBENCHMARK_ONCE {
+        if (json) {
+            const QJsonParseError::ParseError error = loadJson(model, fileName);
+            if (error == QJsonParseError::DocumentTooLarge)
+                QSKIP("The JSON document exceeds the QJsonDocument size limit");
+            QCOMPARE(error, QJsonParseError::NoError);
+        } else {
+            QVERIFY(model.load(fileName));
+        }
+    }
+    QCOMPARE(model.shapeCount(), count);
+}
+
+void SceneBenchmark::loadPeakMemory() {
+#ifdef Q_OS_LINUX
+    QFETCH(int, count);
+    QFETCH(bool, json);
+    const QString fileName = documentFile(count, json);
+
+    const qint64 before = resetPeakResidentSize();
+    if (before < 0)
+        QSKIP("Cannot reset the peak resident size");
+    {
+        GraphicModel model;
+        if (json) {
+            const QJsonParseError::ParseError error = loadJson(model, fileName);
+            if (error == QJsonParseError::DocumentTooLarge)
+                QSKIP("The JSON document exceeds the QJsonDocument size limit");
+            QCOMPARE(error, QJsonParseError::NoError);
+        } else {
+            QVERIFY(model.load(fileName));
+        }
+    }
+    QTest::setBenchmarkResult(processStatus("VmHWM:") - before, QTest::BytesAllocated);
+#else
+    QSKIP("The peak resident size is read from /proc");
+#endif
+}
+
+void SceneBenchmark::bytesPerShape_data() {
+    QTest::addColumn<bool>("inModel");
+    QTest::newRow("shapes") << false;
+    QTest::newRow("in model") << true;
+}
+
+void SceneBenchmark::bytesPerShape() {
+#ifdef Q_OS_LINUX
+    QFETCH(bool, inModel);
+    const int count = 1000000;
+    const QVector<ShapeSpec> specs = makeSpecs(count);
+
+    const qint64 before = resetPeakResidentSize();
+    if (before < 0)
+        QSKIP("Cannot read the resident size");
+    qint64 after;
+    if (inModel) {
+        GraphicModel model;
+        QList<Shape*> shapes;
+        shapes.reserve(count);
+        for (const ShapeSpec& spec : specs) {
+            shapes.append(createShape(model, spec));
+        }
+        model.addShapes(shapes);
+        after = processStatus("VmRSS:");
+    } else {
+        QVector<Shape*> shapes;
+        shapes.reserve(count);
+        for (const ShapeSpec& spec : specs) {
+            shapes.append(buildShape(spec));
+        }
+        after = processStatus("VmRSS:");
+        qDeleteAll(shapes);
+    }
+    QTest::setBenchmarkResult(qreal(after - before) / count, QTest::BytesAllocated);
+#else
+    QSKIP("The resident size is read from /proc");
+#endif
+}
+
+void SceneBenchmark::indexQuery_data() {
+    QTest::addColumn<int>("count");
+    QTest::addColumn<QString>("index");
+    QTest::addColumn<QString>("query");
+    const QPair<QString, int> counts[] = {
+        { QStringLiteral("10k"), 10000 }, { QStringLiteral("100k"), 100000 },
+        { QStringLiteral("1M"), 1000000 },
+    };
+    for (const auto& count : counts) {
+        for (const QString index : { QStringLiteral("rtree"), QStringLiteral("grid") }) {
+            for (const QString query : { QStringLiteral("point"), QStringLiteral("rect"),
+                                         QStringLiteral("nearest") }) {
+                QTest::newRow(qPrintable(count.first + ' ' + index + ' ' + query))
+                    << count.second << index << query;
+            }
+        }
+        QTest::newRow(qPrintable(count.first + QStringLiteral(" scene rect")))
+            << count.second << QStringLiteral("scene") << QStringLiteral("rect");
+    }
+}
+
+void SceneBenchmark::indexQuery() {
+    QFETCH(int, count);
+    QFETCH(QString, index);
+    QFETCH(QString, query);
+    GraphicModel model;
+    model.setSpatialIndexType(index == QLatin1String("grid") ? SpatialIndexType::Grid
+                                                             : SpatialIndexType::RTree);
+    populate(model, count);
+    const QRectF area = model.getScene()->itemsBoundingRect();
+    const QVector<QPointF> points = makePoints(hitTestPoints, area);
+    const QSizeF rubberBand(200, 200); // Рамка выделения в несколько десятков фигур
+    model.shapeAt(points.first()); // Индекс достраивается при первом запросе
+
+    int hits = 0;
+    QBENCHMARK {
+        for (const QPointF& pos : points) {
+            if (index == QLatin1String("scene")) {
+                hits += model.getScene()->items(QRectF(pos, rubberBand)).size();
+            } else if (query == QLatin1String("point")) {
+                hits += model.shapeAt(pos) ? 1 : 0;
+            } else if (query == QLatin1String("rect")) {
+                hits += model.shapesInRect(QRectF(pos, rubberBand)).size();
+            } else {
+                hits += model.nearestShapes(pos, 10).size();
+            }
+        }
+    }
+    Q_UNUSED(hits);
+}
+
+int main(int argc, char* argv[]) {
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+
+    QStringList arguments = app.arguments();
+    QString jsonFileName;
+    const int jsonIndex = arguments.indexOf(QStringLiteral("--json"));
+    if (jsonIndex > 0 && jsonIndex + 1 < arguments.size()) {
+        jsonFileName = arguments.at(jsonIndex + 1);
+        arguments.erase(arguments.begin() + jsonIndex, arguments.begin() + jsonIndex + 2);
+    }
+
+    SceneBenchmark benchmark;
+    if (jsonFileName.isEmpty())
+        return QTest::qExec(&benchmark, arguments);
+
+    // Обычный вывод в консоль плюс XML-журнал, из которого строится JSON
+    QTemporaryFile xmlFile;
+    if (!xmlFile.open())
+        return 1;
+    arguments << QStringLiteral("-o") << QStringLiteral("-,txt")
+              << QStringLiteral("-o") << xmlFile.fileName() + QStringLiteral(",xml");
+    const int status = QTest::qExec(&benchmark, arguments);
+    if (!writeJson(xmlFile.fileName(), jsonFileName)) {
+        qWarning("scenebench: cannot write %s", qPrintable(jsonFileName));
+        return 1;
+    }
+    return status;
+}
+
+#include "scenebench.moc"
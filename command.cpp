@@ -1,41 +1,188 @@
 #include "command.h"
 
-AddCommand::AddCommand(GraphicModel* model, ShapeType type, const QPointF& startPos,
-                       const QColor& color, QUndoCommand* parent)
-    : QUndoCommand(parent), model(model), type(type), startPos(startPos),
-    color(color), shape(nullptr), myFirstTime(true)
+ShapeCommand::ShapeCommand(GraphicModel* model, QUndoCommand* parent)
+    : QUndoCommand(parent), model(model), accountedBytes(0)
+{
+}
+
+ShapeCommand::~ShapeCommand()
+{
+    if (accountedBytes)
+        model->releaseHistoryBytes(accountedBytes);
+}
+
+void ShapeCommand::discard()
+{
+    releaseHistory();
+    for (int i = 0; i < childCount(); ++i) {
+        ShapeCommand* command = dynamic_cast<ShapeCommand*>(const_cast<QUndoCommand*>(child(i)));
+        if (command)
+            command->releaseHistory();
+    }
+
+    if (accountedBytes) {
+        model->releaseHistoryBytes(accountedBytes);
+        accountedBytes = 0;
+    }
+    setObsolete(true);
+}
+
+QList<Shape*> ShapeCommand::resolve(const QVector<quint32>& ids) const
+{
+    QList<Shape*> shapes;
+    shapes.reserve(ids.size());
+    for (quint32 id : ids) {
+        Shape* shape = model->shapeById(id);
+        if (shape)
+            shapes.append(shape);
+    }
+    return shapes;
+}
+
+QVector<quint32> ShapeCommand::idsOf(const QList<Shape*>& shapes)
+{
+    QVector<quint32> ids;
+    ids.reserve(shapes.size());
+    for (Shape* shape : shapes) {
+        ids.append(shape->getId());
+    }
+    return ids;
+}
+
+qint64 ShapeCommand::shapesCost(const QVector<quint32>& ids) const
+{
+    qint64 bytes = ids.capacity() * sizeof(quint32);
+    // Фигуры на сцене живут и без истории; платит она только за снятые
+    for (quint32 id : ids) {
+        const Shape* shape = model->shapeById(id);
+        if (shape && !model->contains(shape))
+            bytes += shape->memoryUsage();
+    }
+    return bytes;
+}
+
+void ShapeCommand::releaseDetached(const QVector<quint32>& ids)
+{
+    for (quint32 id : ids) {
+        Shape* shape = model->shapeById(id);
+        if (shape && !model->contains(shape))
+            model->destroyShape(shape);
+    }
+}
+
+AddCommand::AddCommand(GraphicModel* model, quint32 shapeId, QUndoCommand* parent)
+    : ShapeCommand(model, parent), shapeId(shapeId)
 {
     setText("Add shape");
 }
 
+AddCommand::~AddCommand()
+{
+    // Отмененное добавление выброшено из истории - фигура больше не понадобится
+    releaseDetached({ shapeId });
+}
+
+QList<Shape*> AddCommand::affectedShapes() const
+{
+    return resolve({ shapeId });
+}
+
+qint64 AddCommand::memoryCost() const
+{
+    return sizeof(*this) + shapesCost({ shapeId });
+}
+
+void AddCommand::releaseHistory()
+{
+    // Фигура либо на сцене, либо ее держит более позднее удаление
+    shapeId = 0;
+}
+
 void AddCommand::undo()
 {
-    model->removeShape(shape);
+    model->removeShape(model->shapeById(shapeId));
 }
 
 void AddCommand::redo()
 {
-    if (myFirstTime) {
-        shape = new Shape(type, startPos, color);
-        model->addShape(shape);
-        myFirstTime = false;
-    } else {
+    Shape* shape = model->shapeById(shapeId);
+    if (shape)
         model->addShape(shape);
-    }
+}
+
+AddShapesCommand::AddShapesCommand(GraphicModel* model, const QVector<quint32>& shapeIds,
+                                   QUndoCommand* parent)
+    : ShapeCommand(model, parent), shapeIds(shapeIds)
+{
+    setText(QString("Add %1 shapes").arg(shapeIds.size()));
+}
+
+AddShapesCommand::~AddShapesCommand()
+{
+    releaseDetached(shapeIds);
+}
+
+QList<Shape*> AddShapesCommand::affectedShapes() const
+{
+    return resolve(shapeIds);
+}
+
+qint64 AddShapesCommand::memoryCost() const
+{
+    return sizeof(*this) + shapesCost(shapeIds);
+}
+
+void AddShapesCommand::releaseHistory()
+{
+    shapeIds = QVector<quint32>();
+}
+
+void AddShapesCommand::undo()
+{
+    model->removeShapes(resolve(shapeIds));
+}
+
+void AddShapesCommand::redo()
+{
+    model->addShapes(resolve(shapeIds));
 }
 
 DeleteCommand::DeleteCommand(GraphicModel* model, Shape* shape, QUndoCommand* parent)
-    : QUndoCommand(parent), model(model), shape(shape), wasAdded(true)
+    : ShapeCommand(model, parent), shapeId(shape->getId()), wasAdded(true)
 {
     setText("Delete shape");
     // При создании команды сразу удаляем фигуру
     model->removeShape(shape);
 }
 
+DeleteCommand::~DeleteCommand()
+{
+    releaseDetached({ shapeId });
+}
+
+QList<Shape*> DeleteCommand::affectedShapes() const
+{
+    return resolve({ shapeId });
+}
+
+qint64 DeleteCommand::memoryCost() const
+{
+    return sizeof(*this) + shapesCost({ shapeId });
+}
+
+void DeleteCommand::releaseHistory()
+{
+    // Удаление уже не отменить - фигура больше не понадобится
+    releaseDetached({ shapeId });
+    shapeId = 0;
+}
+
 void DeleteCommand::undo()
 {
     // Возвращаем фигуру на сцену
-    model->addShape(shape);
+    Shape* shape = model->shapeById(shapeId);
+    if (shape)
+        model->addShape(shape);
     wasAdded = true;
 }
 
@@ -43,35 +190,274 @@ void DeleteCommand::redo()
 {
     // Снова удаляем фигуру
     if (wasAdded) {
-        model->removeShape(shape);
+        model->removeShape(model->shapeById(shapeId));
         wasAdded = false;
     }
 }
 
+DeleteShapesCommand::DeleteShapesCommand(GraphicModel* model, const QList<Shape*>& shapes,
+                                         QUndoCommand* parent)
+    : ShapeCommand(model, parent), shapeIds(idsOf(shapes))
+{
+    setText(QString("Delete %1 shapes").arg(shapes.size()));
+}
+
+DeleteShapesCommand::~DeleteShapesCommand()
+{
+    // Удаление, вытесненное из начала истории, уже не отменить
+    releaseDetached(shapeIds);
+}
+
+QList<Shape*> DeleteShapesCommand::affectedShapes() const
+{
+    return resolve(shapeIds);
+}
+
+qint64 DeleteShapesCommand::memoryCost() const
+{
+    return sizeof(*this) + shapesCost(shapeIds);
+}
+
+void DeleteShapesCommand::releaseHistory()
+{
+    releaseDetached(shapeIds);
+    shapeIds = QVector<quint32>();
+}
+
+void DeleteShapesCommand::undo()
+{
+    model->addShapes(resolve(shapeIds));
+}
+
+void DeleteShapesCommand::redo()
+{
+    model->removeShapes(resolve(shapeIds));
+}
+
 MoveCommand::MoveCommand(GraphicModel* model, Shape* shape, const QPointF& oldPos,
                          const QPointF& newPos, QUndoCommand* parent)
-    : QUndoCommand(parent), model(model), shape(shape),
+    : ShapeCommand(model, parent), shapeId(shape->getId()),
     myOldPos(oldPos), myNewPos(newPos)
 {
     setText("Move shape");
 }
 
+QList<Shape*> MoveCommand::affectedShapes() const
+{
+    return resolve({ shapeId });
+}
+
+qint64 MoveCommand::memoryCost() const
+{
+    // Фигура живет на сцене, команда хранит только позиции
+    return sizeof(*this);
+}
+
 void MoveCommand::undo()
 {
-    shape->setPos(myOldPos);
+    Shape* shape = model->shapeById(shapeId);
+    if (shape)
+        shape->setPos(myOldPos);
 }
 
 void MoveCommand::redo()
 {
-    shape->setPos(myNewPos);
+    Shape* shape = model->shapeById(shapeId);
+    if (shape)
+        shape->setPos(myNewPos);
 }
 
 bool MoveCommand::mergeWith(const QUndoCommand* command)
 {
     const MoveCommand* moveCommand = static_cast<const MoveCommand*>(command);
-    if (moveCommand->shape != shape)
+    if (moveCommand->shapeId != shapeId)
         return false;
 
     myNewPos = moveCommand->myNewPos;
     return true;
 }
+
+MoveShapesCommand::MoveShapesCommand(GraphicModel* model, const QList<Shape*>& shapes,
+                                     const QVector<QPointF>& oldPositions, const QPointF& delta,
+                                     QUndoCommand* parent)
+    : ShapeCommand(model, parent), shapeIds(idsOf(shapes)),
+    myOldPositions(oldPositions), myDelta(delta)
+{
+    setText(QString("Move %1 shapes").arg(shapes.size()));
+}
+
+QList<Shape*> MoveShapesCommand::affectedShapes() const
+{
+    return resolve(shapeIds);
+}
+
+qint64 MoveShapesCommand::memoryCost() const
+{
+    return sizeof(*this) + shapeIds.capacity() * sizeof(quint32)
+           + myOldPositions.capacity() * sizeof(QPointF);
+}
+
+void MoveShapesCommand::releaseHistory()
+{
+    shapeIds = QVector<quint32>();
+    myOldPositions = QVector<QPointF>();
+}
+
+void MoveShapesCommand::undo()
+{
+    applyPositions(QPointF());
+}
+
+void MoveShapesCommand::redo()
+{
+    applyPositions(myDelta);
+}
+
+void MoveShapesCommand::applyPositions(const QPointF& delta)
+{
+    for (int i = 0; i < shapeIds.size(); ++i) {
+        Shape* shape = model->shapeById(shapeIds.at(i));
+        if (shape)
+            shape->setPos(myOldPositions.at(i) + delta);
+    }
+}
+
+bool MoveShapesCommand::mergeWith(const QUndoCommand* command)
+{
+    const MoveShapesCommand* moveCommand = static_cast<const MoveShapesCommand*>(command);
+    if (moveCommand->shapeIds != shapeIds)
+        return false;
+
+    myDelta += moveCommand->myDelta;
+    return true;
+}
+
+ColorCommand::ColorCommand(GraphicModel* model, const QList<Shape*>& shapes,
+                           const QColor& color, QUndoCommand* parent)
+    : ShapeCommand(model, parent), shapeIds(idsOf(shapes)), myColor(color)
+{
+    myOldColors.reserve(shapes.size());
+    for (Shape* shape : shapes) {
+        myOldColors.append(shape->getColor());
+    }
+    setText(QString("Change color of %1 shapes").arg(shapes.size()));
+}
+
+QList<Shape*> ColorCommand::affectedShapes() const
+{
+    return resolve(shapeIds);
+}
+
+qint64 ColorCommand::memoryCost() const
+{
+    return sizeof(*this) + shapeIds.capacity() * sizeof(quint32)
+           + myOldColors.capacity() * sizeof(QColor);
+}
+
+void ColorCommand::releaseHistory()
+{
+    shapeIds = QVector<quint32>();
+    myOldColors = QVector<QColor>();
+}
+
+void ColorCommand::undo()
+{
+    for (int i = 0; i < shapeIds.size(); ++i) {
+        Shape* shape = model->shapeById(shapeIds.at(i));
+        if (shape)
+            shape->setColor(myOldColors.at(i));
+    }
+}
+
+void ColorCommand::redo()
+{
+    for (quint32 id : shapeIds) {
+        Shape* shape = model->shapeById(id);
+        if (shape)
+            shape->setColor(myColor);
+    }
+}
+
+TextCommand::TextCommand(GraphicModel* model, Shape* shape, const QString& text,
+                         const QFont& font, QUndoCommand* parent)
+    : ShapeCommand(model, parent), shapeId(shape->getId()),
+    myOldText(shape->getText()), myOldFont(shape->getFont()),
+    myText(text), myFont(font)
+{
+    setText("Edit text");
+}
+
+QList<Shape*> TextCommand::affectedShapes() const
+{
+    return resolve({ shapeId });
+}
+
+qint64 TextCommand::memoryCost() const
+{
+    return sizeof(*this) + (myOldText.capacity() + myText.capacity()) * sizeof(QChar);
+}
+
+void TextCommand::undo()
+{
+    apply(myOldText, myOldFont);
+}
+
+void TextCommand::redo()
+{
+    apply(myText, myFont);
+}
+
+void TextCommand::apply(const QString& text, const QFont& font)
+{
+    Shape* shape = model->shapeById(shapeId);
+    if (!shape)
+        return;
+    if (shape->getFont() != font)
+        shape->setFont(font);
+    if (shape->getText() != text)
+        shape->setText(text);
+}
+
+ResizeCommand::ResizeCommand(GraphicModel* model, Shape* shape, const QPointF& oldStart,
+                             const QPointF& oldEnd, QUndoCommand* parent)
+    : ShapeCommand(model, parent), shapeId(shape->getId()),
+    myOldStart(oldStart), myOldEnd(oldEnd),
+    myNewStart(shape->getStartPos()), myNewEnd(shape->getEndPos())
+{
+    setText("Resize shape");
+}
+
+QList<Shape*> ResizeCommand::affectedShapes() const
+{
+    return resolve({ shapeId });
+}
+
+qint64 ResizeCommand::memoryCost() const
+{
+    return sizeof(*this);
+}
+
+void ResizeCommand::undo()
+{
+    Shape* shape = model->shapeById(shapeId);
+    if (shape)
+        shape->setGeometry(myOldStart, myOldEnd);
+}
+
+void ResizeCommand::redo()
+{
+    Shape* shape = model->shapeById(shapeId);
+    if (shape)
+        shape->setGeometry(myNewStart, myNewEnd);
+}
+
+bool ResizeCommand::mergeWith(const QUndoCommand* command)
+{
+    const ResizeCommand* resizeCommand = static_cast<const ResizeCommand*>(command);
+    if (resizeCommand->shapeId != shapeId)
+        return false;
+
+    myNewStart = resizeCommand->myNewStart;
+    myNewEnd = resizeCommand->myNewEnd;
+    return true;
+}
@@ -5,51 +5,210 @@
 #include "graphicmodel.h"
 #include "shape.h"
 
-class AddCommand : public QUndoCommand
+// Команда над фигурами; affectedShapes() нужен журналу автосохранения,
+// чтобы записать состояние затронутых фигур после redo/undo.
+// Фигуры хранятся по id и разрешаются через модель, которая ими владеет.
+class ShapeCommand : public QUndoCommand
 {
 public:
-    AddCommand(GraphicModel* model, ShapeType type, const QPointF& startPos,
-               const QColor& color, QUndoCommand* parent = nullptr);
+    explicit ShapeCommand(GraphicModel* model, QUndoCommand* parent = nullptr);
+    ~ShapeCommand() override;
+    virtual QList<Shape*> affectedShapes() const = 0;
+    // Приблизительный объем памяти, который команда удерживает в истории
+    virtual qint64 memoryCost() const = 0;
+    // Отдает память, которую держит только история, и помечает команду
+    // устаревшей: QUndoStack удалит ее без отмены, когда до нее дойдет undo()
+    void discard();
+
+protected:
+    // Выполненная команда больше не будет отменена
+    virtual void releaseHistory() {}
+
+    QList<Shape*> resolve(const QVector<quint32>& ids) const;
+    static QVector<quint32> idsOf(const QList<Shape*>& shapes);
+    qint64 shapesCost(const QVector<quint32>& ids) const;
+    // Фигуры, которые уже никто не вернет на сцену, освобождаются вместе с командой
+    void releaseDetached(const QVector<quint32>& ids);
+
+    GraphicModel* model;
+
+private:
+    friend class GraphicModel;
+    qint64 accountedBytes; // Учтено в GraphicModel::historyMemoryUsage()
+};
+
+class AddCommand : public ShapeCommand
+{
+public:
+    AddCommand(GraphicModel* model, quint32 shapeId, QUndoCommand* parent = nullptr);
+    ~AddCommand() override;
     void undo() override;
     void redo() override;
+    QList<Shape*> affectedShapes() const override;
+    qint64 memoryCost() const override;
+
+protected:
+    void releaseHistory() override;
 
 private:
-    GraphicModel* model;
-    Shape* shape;
-    ShapeType type;
-    QPointF startPos;
-    QColor color;
-    bool myFirstTime;
+    quint32 shapeId;
+};
+
+class AddShapesCommand : public ShapeCommand
+{
+public:
+    AddShapesCommand(GraphicModel* model, const QVector<quint32>& shapeIds,
+                     QUndoCommand* parent = nullptr);
+    ~AddShapesCommand() override;
+    void undo() override;
+    void redo() override;
+    QList<Shape*> affectedShapes() const override;
+    qint64 memoryCost() const override;
+
+protected:
+    void releaseHistory() override;
+
+private:
+    QVector<quint32> shapeIds;
 };
 
-class DeleteCommand : public QUndoCommand
+class DeleteCommand : public ShapeCommand
 {
 public:
     DeleteCommand(GraphicModel* model, Shape* shape, QUndoCommand* parent = nullptr);
+    ~DeleteCommand() override;
     void undo() override;
     void redo() override;
+    QList<Shape*> affectedShapes() const override;
+    qint64 memoryCost() const override;
+
+protected:
+    void releaseHistory() override;
 
 private:
-    GraphicModel* model;
-    Shape* shape;
+    quint32 shapeId;
     bool wasAdded; // Флаг, указывающий, была ли фигура добавлена в модель
 };
 
-class MoveCommand : public QUndoCommand
+class DeleteShapesCommand : public ShapeCommand
+{
+public:
+    DeleteShapesCommand(GraphicModel* model, const QList<Shape*>& shapes,
+                        QUndoCommand* parent = nullptr);
+    ~DeleteShapesCommand() override;
+    void undo() override;
+    void redo() override;
+    QList<Shape*> affectedShapes() const override;
+    qint64 memoryCost() const override;
+
+protected:
+    void releaseHistory() override;
+
+private:
+    QVector<quint32> shapeIds;
+};
+
+class MoveCommand : public ShapeCommand
 {
 public:
     MoveCommand(GraphicModel* model, Shape* shape, const QPointF& oldPos,
                 const QPointF& newPos, QUndoCommand* parent = nullptr);
     void undo() override;
     void redo() override;
+    QList<Shape*> affectedShapes() const override;
+    qint64 memoryCost() const override;
     bool mergeWith(const QUndoCommand* command) override;
     int id() const override { return 1; }
 
 private:
-    GraphicModel* model;
-    Shape* shape;
+    quint32 shapeId;
     QPointF myOldPos;
     QPointF myNewPos;
 };
 
+// Перемещение группы фигур одним смещением
+class MoveShapesCommand : public ShapeCommand
+{
+public:
+    MoveShapesCommand(GraphicModel* model, const QList<Shape*>& shapes,
+                      const QVector<QPointF>& oldPositions, const QPointF& delta,
+                      QUndoCommand* parent = nullptr);
+    void undo() override;
+    void redo() override;
+    QList<Shape*> affectedShapes() const override;
+    qint64 memoryCost() const override;
+    bool mergeWith(const QUndoCommand* command) override;
+    int id() const override { return 3; }
+
+protected:
+    void releaseHistory() override;
+
+private:
+    void applyPositions(const QPointF& delta);
+
+    QVector<quint32> shapeIds;
+    QVector<QPointF> myOldPositions;
+    QPointF myDelta;
+};
+
+class ColorCommand : public ShapeCommand
+{
+public:
+    ColorCommand(GraphicModel* model, const QList<Shape*>& shapes, const QColor& color,
+                 QUndoCommand* parent = nullptr);
+    void undo() override;
+    void redo() override;
+    QList<Shape*> affectedShapes() const override;
+    qint64 memoryCost() const override;
+
+protected:
+    void releaseHistory() override;
+
+private:
+    QVector<quint32> shapeIds;
+    QVector<QColor> myOldColors;
+    QColor myColor;
+};
+
+// Текст и шрифт надписи: обе правки окна "Edit Text" - одна команда
+class TextCommand : public ShapeCommand
+{
+public:
+    TextCommand(GraphicModel* model, Shape* shape, const QString& text, const QFont& font,
+                QUndoCommand* parent = nullptr);
+    void undo() override;
+    void redo() override;
+    QList<Shape*> affectedShapes() const override;
+    qint64 memoryCost() const override;
+
+private:
+    void apply(const QString& text, const QFont& font);
+
+    quint32 shapeId;
+    QString myOldText;
+    QFont myOldFont;
+    QString myText;
+    QFont myFont;
+};
+
+class ResizeCommand : public ShapeCommand
+{
+public:
+    ResizeCommand(GraphicModel* model, Shape* shape, const QPointF& oldStart,
+                  const QPointF& oldEnd, QUndoCommand* parent = nullptr);
+    void undo() override;
+    void redo() override;
+    QList<Shape*> affectedShapes() const override;
+    qint64 memoryCost() const override;
+    bool mergeWith(const QUndoCommand* command) override;
+    int id() const override { return 2; }
+
+private:
+    quint32 shapeId;
+    QPointF myOldStart;
+    QPointF myOldEnd;
+    QPointF myNewStart;
+    QPointF myNewEnd;
+};
+
 #endif // COMMAND_H
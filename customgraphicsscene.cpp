@@ -1,12 +1,234 @@
 #include "customgraphicsscene.h"
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QtMath>
+#include "profiler.h"
+#include "shape.h"
+
+namespace {
+const int tileSize = 256; // Размер тайла в пикселях устройства
+const int batchCellSize = 1024; // Размер ячейки пакетов в пикселях устройства
+const int batchCacheShapes = 1000000; // Сколько фигур держат все закэшированные ячейки
+// С такого размера выделения BSP-индекс на время перетаскивания отключается:
+// переиндексировать тысячи фигур каждый кадр дороже, чем перестроить индекс один раз
+const int unindexedMoveThreshold = 500;
+}
 
 CustomGraphicsScene::CustomGraphicsScene(QObject *parent)
-    : QGraphicsScene(parent)
+    : QGraphicsScene(parent), throttle(new FrameThrottle(this)), selectionMoveActive(false),
+    savedIndexMethod(BspTreeIndex), tileCacheEnabled(false), tileLayerActive(false),
+    renderingTile(false), batchedRendering(false), batchLayerActive(false)
+{
+    setTileCacheBudget(64 * 1024);
+    batchCells.setMaxCost(batchCacheShapes);
+}
+
+void CustomGraphicsScene::setTileCacheEnabled(bool enabled)
+{
+    tileCacheEnabled = enabled;
+    tileLayerActive = false;
+    tiles.clear();
+    update();
+}
+
+bool CustomGraphicsScene::isTileCacheEnabled() const
+{
+    return tileCacheEnabled;
+}
+
+void CustomGraphicsScene::setTileCacheBudget(int kilobytes)
+{
+    tiles.setMaxCost(kilobytes);
+}
+
+void CustomGraphicsScene::invalidateTiles(const QRectF &sceneRect)
+{
+    for (const TileKey &key : tiles.keys()) {
+        const qreal tileSceneSize = tileSize * 1000.0 / key.zoom;
+        const QRectF tileRect(key.x * tileSceneSize, key.y * tileSceneSize,
+                              tileSceneSize, tileSceneSize);
+        if (tileRect.intersects(sceneRect)) {
+            tiles.remove(key);
+        }
+    }
+
+    for (const TileKey &key : batchCells.keys()) {
+        const qreal cellSceneSize = batchCellSize * 1000.0 / key.zoom;
+        const QRectF cellRect(key.x * cellSceneSize, key.y * cellSceneSize,
+                              cellSceneSize, cellSceneSize);
+        if (cellRect.intersects(sceneRect)) {
+            batchCells.remove(key);
+        }
+    }
+}
+
+void CustomGraphicsScene::invalidateAllTiles()
+{
+    tiles.clear();
+    batchCells.clear();
+    update();
+}
+
+bool CustomGraphicsScene::paintsStaticShapesFromTiles() const
+{
+    return tileLayerActive && !renderingTile;
+}
+
+void CustomGraphicsScene::setBatchedRendering(bool enabled)
+{
+    batchedRendering = enabled;
+    batchLayerActive = false;
+    tiles.clear();
+    batchCells.clear();
+    update();
+}
+
+bool CustomGraphicsScene::isBatchedRendering() const
+{
+    return batchedRendering;
+}
+
+bool CustomGraphicsScene::paintsShapeInBatch(const Shape *shape) const
+{
+    return batchLayerActive && !renderingTile && BatchRenderer::accepts(shape);
+}
+
+FrameThrottle *CustomGraphicsScene::frameThrottle() const
+{
+    return throttle;
+}
+
+void CustomGraphicsScene::notifyShapeResized(Shape *shape, const QPointF &oldStart,
+                                             const QPointF &oldEnd)
+{
+    emit shapeResized(shape, oldStart, oldEnd);
+}
+
+void CustomGraphicsScene::moveSelection(const QPointF &delta)
+{
+    if (!selectionMoveActive)
+        beginSelectionMove();
+
+    moveDelta = delta;
+    throttle->request([this]() { applySelectionMove(); });
+}
+
+void CustomGraphicsScene::finishSelectionMove()
+{
+    if (!selectionMoveActive)
+        return;
+
+    throttle->flush();
+    const QList<Shape *> shapes = movingShapes;
+    const QVector<QPointF> origins = moveOrigins;
+    const QPointF delta = moveDelta;
+    endSelectionMove();
+
+    if (!delta.isNull() && !shapes.isEmpty())
+        emit selectionMoved(shapes, origins, delta);
+}
+
+void CustomGraphicsScene::cancelSelectionMove()
+{
+    if (!selectionMoveActive)
+        return;
+
+    // Перемещение без команды отмены оставлять нельзя - фигуры возвращаются
+    // на исходные места (та, что уходит со сцены, тоже: ее вернет undo)
+    throttle->cancel();
+    for (int i = 0; i < movingShapes.size(); ++i) {
+        movingShapes.at(i)->setPos(moveOrigins.at(i));
+    }
+    endSelectionMove();
+}
+
+bool CustomGraphicsScene::isMovingSelection() const
+{
+    return selectionMoveActive;
+}
+
+void CustomGraphicsScene::setRubberBand(const QRectF &rect)
+{
+    if (rect == rubberBand)
+        return;
+
+    const QRectF dirty = rubberBand.united(rect).adjusted(-1, -1, 1, 1);
+    rubberBand = rect;
+    update(dirty);
+}
+
+void CustomGraphicsScene::beginSelectionMove()
 {
+    selectionMoveActive = true;
+    moveDelta = QPointF();
+    movingShapes.clear();
+    moveOrigins.clear();
+
+    for (QGraphicsItem *item : selectedItems()) {
+        Shape *shape = dynamic_cast<Shape *>(item);
+        if (shape && (shape->flags() & QGraphicsItem::ItemIsMovable)) {
+            movingShapes.append(shape);
+            moveOrigins.append(shape->pos());
+        }
+    }
+    movePositions.resize(moveOrigins.size());
+
+    savedIndexMethod = itemIndexMethod();
+    if (movingShapes.size() >= unindexedMoveThreshold && savedIndexMethod != NoIndex)
+        setItemIndexMethod(NoIndex);
+}
+
+void CustomGraphicsScene::applySelectionMove()
+{
+    // Сначала все позиции одним проходом по непрерывным массивам, затем setPos
+    const int count = moveOrigins.size();
+    const QPointF *origins = moveOrigins.constData();
+    QPointF *positions = movePositions.data();
+    const qreal dx = moveDelta.x();
+    const qreal dy = moveDelta.y();
+    for (int i = 0; i < count; ++i) {
+        positions[i] = QPointF(origins[i].x() + dx, origins[i].y() + dy);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        movingShapes.at(i)->setPos(positions[i]);
+    }
+}
+
+void CustomGraphicsScene::endSelectionMove()
+{
+    selectionMoveActive = false;
+    movingShapes.clear();
+    moveOrigins.clear();
+    movePositions.clear();
+    if (itemIndexMethod() != savedIndexMethod)
+        setItemIndexMethod(savedIndexMethod);
+}
+
+void CustomGraphicsScene::setShapePicker(const std::function<Shape *(const QPointF &)> &picker)
+{
+    shapePicker = picker;
 }
 
 void CustomGraphicsScene::mousePressEvent(QGraphicsSceneMouseEvent *event)
 {
+    PROFILE_INPUT();
+    if (shapePicker && !mouseGrabberItem()) {
+        Shape *shape = shapePicker(event->scenePos());
+        if (shape)
+            sendPress(shape, event);
+        else
+            event->ignore();
+
+        if (!event->isAccepted()) {
+            // Как QGraphicsScene при нажатии мимо элементов
+            if (!(event->modifiers() & Qt::ControlModifier))
+                clearSelection();
+            emit sceneMousePressed(event->scenePos());
+        }
+        return;
+    }
+
     QGraphicsScene::mousePressEvent(event);
     if (!event->isAccepted()) {
         emit sceneMousePressed(event->scenePos());
@@ -15,6 +237,7 @@ void CustomGraphicsScene::mousePressEvent(QGraphicsSceneMouseEvent *event)
 
 void CustomGraphicsScene::mouseMoveEvent(QGraphicsSceneMouseEvent *event)
 {
+    PROFILE_INPUT();
     QGraphicsScene::mouseMoveEvent(event);
     if (!event->isAccepted()) {
         emit sceneMouseMoved(event->scenePos());
@@ -23,8 +246,166 @@ void CustomGraphicsScene::mouseMoveEvent(QGraphicsSceneMouseEvent *event)
 
 void CustomGraphicsScene::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
 {
+    PROFILE_INPUT();
     QGraphicsScene::mouseReleaseEvent(event);
+    // Захват из sendPress() явный, базовый класс его не снимает
+    if (event->buttons() == Qt::NoButton && mouseGrabberItem())
+        mouseGrabberItem()->ungrabMouse();
     if (!event->isAccepted()) {
         emit sceneMouseReleased();
     }
 }
+
+void CustomGraphicsScene::sendPress(Shape *shape, QGraphicsSceneMouseEvent *event)
+{
+    // Координаты элемента заполняет только внутренняя доставка QGraphicsScene
+    event->setPos(shape->mapFromScene(event->scenePos()));
+    event->setLastPos(shape->mapFromScene(event->lastScenePos()));
+    for (int button = Qt::LeftButton; button <= Qt::ExtraButton2; button <<= 1) {
+        const Qt::MouseButton mouseButton = static_cast<Qt::MouseButton>(button);
+        event->setButtonDownPos(mouseButton,
+                                shape->mapFromScene(event->buttonDownScenePos(mouseButton)));
+    }
+    event->accept();
+    sendEvent(shape, event);
+
+    // Вместо неявного захвата: движения и отпускание получит эта фигура
+    if (event->isAccepted())
+        shape->grabMouse();
+}
+
+void CustomGraphicsScene::drawBackground(QPainter *painter, const QRectF &rect)
+{
+    PROFILE_FRAME_BEGIN();
+    QGraphicsScene::drawBackground(painter, rect);
+
+    // Тайлы строятся только для чистого масштабирования без поворота
+    const QTransform transform = painter->worldTransform();
+    tileLayerActive = tileCacheEnabled && transform.type() <= QTransform::TxScale
+                      && qFuzzyCompare(transform.m11(), transform.m22());
+    batchLayerActive = false;
+    if (!tileLayerActive) {
+        if (batchedRendering)
+            paintBatches(painter, rect);
+        return;
+    }
+
+    const int zoom = qMax(1, qRound(transform.m11() * 1000));
+    const qreal scale = zoom / 1000.0;
+    const qreal tileSceneSize = tileSize / scale;
+
+    const int left = qFloor(rect.left() / tileSceneSize);
+    const int right = qFloor(rect.right() / tileSceneSize);
+    const int top = qFloor(rect.top() / tileSceneSize);
+    const int bottom = qFloor(rect.bottom() / tileSceneSize);
+
+    for (int y = top; y <= bottom; ++y) {
+        for (int x = left; x <= right; ++x) {
+            const TileKey key = { zoom, x, y };
+            const QRectF tileRect(x * tileSceneSize, y * tileSceneSize,
+                                  tileSceneSize, tileSceneSize);
+            QPixmap *tile = tiles.object(key);
+            if (!tile) {
+                tile = new QPixmap(renderTile(tileRect, scale, painter->renderHints()));
+                tiles.insert(key, tile, tileSize * tileSize * 4 / 1024);
+            }
+            painter->drawPixmap(tileRect, *tile, QRectF(0, 0, tileSize, tileSize));
+        }
+    }
+}
+
+void CustomGraphicsScene::drawForeground(QPainter *painter, const QRectF &rect)
+{
+    QGraphicsScene::drawForeground(painter, rect);
+    PROFILE_FRAME_END();
+    if (rubberBand.isEmpty())
+        return;
+
+    painter->save();
+    painter->setRenderHint(QPainter::Antialiasing, false);
+    QPen pen(QColor(0, 120, 215));
+    pen.setCosmetic(true);
+    pen.setStyle(Qt::DashLine);
+    painter->setPen(pen);
+    painter->setBrush(QColor(0, 120, 215, 40));
+    painter->drawRect(rubberBand);
+    painter->restore();
+}
+
+QPixmap CustomGraphicsScene::renderTile(const QRectF &tileRect, qreal scale,
+                                        QPainter::RenderHints hints)
+{
+    QPixmap pixmap(tileSize, tileSize);
+    pixmap.fill(Qt::transparent);
+
+    QPainter painter(&pixmap);
+    painter.setRenderHints(hints);
+    painter.scale(scale, scale);
+    painter.translate(-tileRect.topLeft());
+
+    renderingTile = true;
+    QStyleOptionGraphicsItem option;
+    const QList<QGraphicsItem *> tileItems = items(tileRect, Qt::IntersectsItemBoundingRect,
+                                                   Qt::AscendingOrder);
+    if (batchedRendering) {
+        BatchRenderer batcher;
+        batcher.build(tileItems, scale);
+        batcher.paint(&painter);
+    }
+    for (QGraphicsItem *item : tileItems) {
+        Shape *shape = dynamic_cast<Shape *>(item);
+        if (!shape || shape->isLive() || !shape->isVisible())
+            continue;
+        if (batchedRendering && BatchRenderer::accepts(shape))
+            continue;
+
+        painter.save();
+        painter.setTransform(item->sceneTransform(), true);
+        option.exposedRect = item->boundingRect();
+        shape->paint(&painter, &option);
+        painter.restore();
+    }
+    renderingTile = false;
+
+    return pixmap;
+}
+
+void CustomGraphicsScene::paintBatches(QPainter *painter, const QRectF &rect)
+{
+    // Выделенные и "живые" фигуры рисуются своим paint() поверх пакетов,
+    // как и поверх тайлов
+    batchLayerActive = true;
+    const qreal lod = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    const int zoom = qMax(1, qRound(lod * 1000));
+    const qreal cellSceneSize = batchCellSize * 1000.0 / zoom;
+
+    const int left = qFloor(rect.left() / cellSceneSize);
+    const int right = qFloor(rect.right() / cellSceneSize);
+    const int top = qFloor(rect.top() / cellSceneSize);
+    const int bottom = qFloor(rect.bottom() / cellSceneSize);
+
+    // Ячейка содержит все фигуры, задевающие ее, в порядке наложения, и
+    // рисуется с отсечением по своим границам - стыки ячеек не видны
+    for (int y = top; y <= bottom; ++y) {
+        for (int x = left; x <= right; ++x) {
+            const TileKey key = { zoom, x, y };
+            const QRectF cellRect(x * cellSceneSize, y * cellSceneSize,
+                                  cellSceneSize, cellSceneSize);
+            BatchRenderer *cell = batchCells.object(key);
+            if (!cell) {
+                cell = new BatchRenderer;
+                cell->build(items(cellRect, Qt::IntersectsItemBoundingRect, Qt::AscendingOrder),
+                            zoom / 1000.0);
+                // Стоимость не больше бюджета: иначе QCache удалил бы ячейку сразу
+                batchCells.insert(key, cell, qBound(1, cell->shapeCount(), batchCells.maxCost()));
+            }
+            if (cell->batchCount() == 0)
+                continue;
+
+            painter->save();
+            painter->setClipRect(cellRect, Qt::IntersectClip);
+            cell->paint(painter);
+            painter->restore();
+        }
+    }
+}
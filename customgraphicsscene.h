@@ -3,6 +3,32 @@
 
 #include <QGraphicsScene>
 #include <QGraphicsSceneMouseEvent>
+#include <QCache>
+#include <QPixmap>
+#include <QPainter>
+#include <functional>
+#include "batchrenderer.h"
+#include "framethrottle.h"
+
+class Shape;
+
+// Ключ растрового тайла: масштаб (в тысячных) и номер тайла в сетке сцены
+struct TileKey
+{
+    int zoom;
+    int x;
+    int y;
+};
+
+inline bool operator==(const TileKey &a, const TileKey &b)
+{
+    return a.zoom == b.zoom && a.x == b.x && a.y == b.y;
+}
+
+inline uint qHash(const TileKey &key, uint seed = 0)
+{
+    return qHash(key.x, seed) ^ (qHash(key.y, seed) * 31u) ^ (qHash(key.zoom, seed) * 131u);
+}
 
 class CustomGraphicsScene : public QGraphicsScene
 {
@@ -10,7 +36,47 @@ class CustomGraphicsScene : public QGraphicsScene
 public:
     explicit CustomGraphicsScene(QObject *parent = nullptr);
 
+    // Кэш тайлов: неподвижные фигуры растеризуются в тайлы фона,
+    // каждый кадр поверх рисуются только "живые" фигуры (Shape::isLive)
+    void setTileCacheEnabled(bool enabled);
+    bool isTileCacheEnabled() const;
+    void setTileCacheBudget(int kilobytes);
+    void invalidateTiles(const QRectF &sceneRect);
+    void invalidateAllTiles();
+    bool paintsStaticShapesFromTiles() const;
+
+    // Пакетная отрисовка: неподвижные фигуры рисуются в drawBackground
+    // группами по виду и стилю (BatchRenderer), остальные - своим paint().
+    // Пакеты строятся по ячейкам сетки сцены и хранятся между кадрами;
+    // invalidateTiles() сбрасывает и их
+    void setBatchedRendering(bool enabled);
+    bool isBatchedRendering() const;
+    bool paintsShapeInBatch(const Shape *shape) const;
+
+    // Общий для перетаскиваний ограничитель: одно изменение геометрии за кадр
+    FrameThrottle *frameThrottle() const;
+    // Фигура закончила интерактивное изменение размера
+    void notifyShapeResized(Shape *shape, const QPointF &oldStart, const QPointF &oldEnd);
+
+    // Перетаскивание всего выделения одним смещением от точки нажатия.
+    // Позиции считаются в непрерывном массиве, применяются раз в кадр;
+    // для больших выделений индекс сцены перестраивается один раз в конце.
+    void moveSelection(const QPointF &delta);
+    void finishSelectionMove();
+    void cancelSelectionMove(); // Фигура ушла со сцены посреди перетаскивания: откат
+    bool isMovingSelection() const;
+
+    // Рамка выделения, рисуется поверх фигур; пустой прямоугольник скрывает ее
+    void setRubberBand(const QRectF &rect);
+
+    // Фигура под точкой нажатия; модель отвечает своим пространственным
+    // индексом, и BSP сцены при нажатии не опрашивается
+    void setShapePicker(const std::function<Shape *(const QPointF &)> &picker);
+
 signals:
+    void shapeResized(Shape *shape, const QPointF &oldStart, const QPointF &oldEnd);
+    void selectionMoved(const QList<Shape *> &shapes, const QVector<QPointF> &oldPositions,
+                        const QPointF &delta);
     void sceneMousePressed(const QPointF &pos);
     void sceneMouseMoved(const QPointF &pos);
     void sceneMouseReleased();
@@ -19,6 +85,33 @@ protected:
     void mousePressEvent(QGraphicsSceneMouseEvent *event) override;
     void mouseMoveEvent(QGraphicsSceneMouseEvent *event) override;
     void mouseReleaseEvent(QGraphicsSceneMouseEvent *event) override;
+    void drawBackground(QPainter *painter, const QRectF &rect) override;
+    void drawForeground(QPainter *painter, const QRectF &rect) override;
+
+private:
+    QPixmap renderTile(const QRectF &tileRect, qreal scale, QPainter::RenderHints hints);
+    void paintBatches(QPainter *painter, const QRectF &rect);
+    void sendPress(Shape *shape, QGraphicsSceneMouseEvent *event);
+    void beginSelectionMove();
+    void applySelectionMove();
+    void endSelectionMove();
+
+    QCache<TileKey, QPixmap> tiles;
+    QCache<TileKey, BatchRenderer> batchCells; // Ключ - масштаб и ячейка, как у тайлов
+    std::function<Shape *(const QPointF &)> shapePicker;
+    FrameThrottle *throttle;
+    QList<Shape *> movingShapes;
+    QVector<QPointF> moveOrigins;
+    QVector<QPointF> movePositions;
+    QPointF moveDelta;
+    bool selectionMoveActive;
+    QRectF rubberBand;
+    ItemIndexMethod savedIndexMethod;
+    bool tileCacheEnabled;
+    bool tileLayerActive;
+    bool renderingTile;
+    bool batchedRendering;
+    bool batchLayerActive;
 };
 
 #endif // CUSTOMGRAPHICSSCENE_H
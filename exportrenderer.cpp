@@ -0,0 +1,286 @@
+#include "exportrenderer.h"
+#include <QAtomicInt>
+#include <QFileInfo>
+#include <QFontDatabase>
+#include <QImageWriter>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QSvgGenerator>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <QtMath>
+#include <cstring>
+#include "graphicmodel.h"
+#include "shapedocument.h"
+
+namespace {
+const qreal exportMargin = 10; // Поля вокруг фигур, если область не задана
+}
+
+struct RenderList::Data {
+    QVector<Item> items;
+    QRectF bounds;
+};
+
+RenderList::RenderList() : d(new Data) {}
+
+RenderList RenderList::snapshot(const ShapeRange& shapes) {
+    QSharedPointer<Data> data(new Data);
+    data->items.reserve(shapes.size());
+    for (Shape* shape : shapes) {
+        Item item;
+        item.type = shape->getType();
+        item.startPos = shape->getStartPos();
+        item.endPos = shape->getEndPos();
+        item.pos = shape->pos();
+        const ShapeStyle& style = shape->getStyle();
+        item.pen = style.pen;
+        item.font = style.font;
+        item.text = shape->getText();
+        item.bounds = shape->sceneBoundingRect();
+        data->bounds = data->bounds.united(item.bounds);
+        data->items.append(item);
+    }
+
+    RenderList list;
+    list.d = data;
+    return list;
+}
+
+int RenderList::size() const {
+    return d->items.size();
+}
+
+QRectF RenderList::bounds() const {
+    return d->bounds;
+}
+
+const RenderList::Item& RenderList::item(int index) const {
+    return d->items.at(index);
+}
+
+void RenderList::paint(QPainter* painter, const QRectF& clip) const {
+    for (int i = 0; i < d->items.size(); ++i) {
+        if (d->items.at(i).bounds.intersects(clip))
+            paintItem(painter, i);
+    }
+}
+
+void RenderList::paintItem(QPainter* painter, int index) const {
+    // То же, что Shape::paint для невыделенной фигуры, но без QGraphicsItem
+    const Item& item = d->items.at(index);
+    painter->save();
+    painter->translate(item.pos);
+    painter->setPen(item.pen);
+    painter->setBrush(Qt::NoBrush);
+
+    switch (item.type) {
+    case ShapeType::Line:
+        painter->drawLine(item.startPos, item.endPos);
+        break;
+    case ShapeType::Rectangle:
+        painter->drawRect(QRectF(item.startPos, item.endPos));
+        break;
+    case ShapeType::Ellipse:
+        painter->drawEllipse(QRectF(item.startPos, item.endPos));
+        break;
+    case ShapeType::Triangle:
+        painter->drawPolygon(Shape::trianglePolygon(item.startPos, item.endPos));
+        break;
+    case ShapeType::Text:
+        painter->setFont(item.font);
+        painter->drawText(QRectF(item.startPos, QSizeF()),
+                          Qt::AlignLeft | Qt::AlignTop | Qt::TextDontClip, item.text);
+        break;
+    }
+    painter->restore();
+}
+
+ExportFormat ExportRenderer::formatForFile(const QString& fileName) {
+    const QString suffix = QFileInfo(fileName).suffix().toLower();
+    if (suffix == QLatin1String("svg"))
+        return ExportFormat::Svg;
+    if (suffix == QLatin1String("pdf"))
+        return ExportFormat::Pdf;
+    return ExportFormat::Png;
+}
+
+QRectF ExportRenderer::sourceRectFor(const RenderList& list, const ExportOptions& options) {
+    if (!options.sourceRect.isEmpty())
+        return options.sourceRect;
+    return list.bounds().adjusted(-exportMargin, -exportMargin, exportMargin, exportMargin);
+}
+
+QImage ExportRenderer::renderImage(const RenderList& list, const ExportOptions& options) {
+    const QRectF source = sourceRectFor(list, options);
+    const QSize size(qMax(1, qCeil(source.width() * options.scale)),
+                     qMax(1, qCeil(source.height() * options.scale)));
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    if (image.isNull())
+        return image; // Не хватило памяти
+
+    // Раскладываем фигуры по тайлам заранее, порядок внутри тайла сохраняется
+    const int tileSize = qMax(64, options.tileSize);
+    const int columns = (size.width() + tileSize - 1) / tileSize;
+    const int rows = (size.height() + tileSize - 1) / tileSize;
+    QVector<QVector<int>> buckets(columns * rows);
+    for (int i = 0; i < list.size(); ++i) {
+        const QRectF r = list.item(i).bounds.translated(-source.topLeft());
+        if (!r.intersects(QRectF(QPointF(), source.size())))
+            continue;
+        const int left = qBound(0, qFloor(r.left() * options.scale) / tileSize, columns - 1);
+        const int right = qBound(0, qFloor(r.right() * options.scale) / tileSize, columns - 1);
+        const int top = qBound(0, qFloor(r.top() * options.scale) / tileSize, rows - 1);
+        const int bottom = qBound(0, qFloor(r.bottom() * options.scale) / tileSize, rows - 1);
+        for (int y = top; y <= bottom; ++y) {
+            for (int x = left; x <= right; ++x) {
+                buckets[y * columns + x].append(i);
+            }
+        }
+    }
+
+    // bits() отделяет данные здесь, в вызывающем потоке; дальше потоки пишут
+    // в непересекающиеся строки общего буфера
+    uchar* bits = image.bits();
+    const int bytesPerLine = image.bytesPerLine();
+    QAtomicInt nextTile(0);
+
+    auto renderTiles = [&]() {
+        for (int index = nextTile.fetchAndAddRelaxed(1); index < buckets.size();
+             index = nextTile.fetchAndAddRelaxed(1)) {
+            const QRect tileRect(index % columns * tileSize, index / columns * tileSize,
+                                 tileSize, tileSize);
+            const QRect target = tileRect.intersected(QRect(QPoint(), size));
+
+            QImage tile(target.size(), QImage::Format_ARGB32_Premultiplied);
+            tile.fill(options.background);
+            QPainter painter(&tile);
+            painter.setRenderHint(QPainter::Antialiasing);
+            painter.setRenderHint(QPainter::TextAntialiasing);
+            painter.translate(-target.topLeft());
+            painter.scale(options.scale, options.scale);
+            painter.translate(-source.topLeft());
+            for (int item : buckets.at(index)) {
+                list.paintItem(&painter, item);
+            }
+            painter.end();
+
+            for (int y = 0; y < target.height(); ++y) {
+                std::memcpy(bits + (target.top() + y) * bytesPerLine + target.left() * 4,
+                            tile.constScanLine(y), target.width() * 4);
+            }
+        }
+    };
+
+    int threads = options.threadCount > 0 ? options.threadCount : QThread::idealThreadCount();
+    if (!QFontDatabase::supportsThreadedFontRendering())
+        threads = 1; // Текст на этой платформе рисуется только из GUI-потока
+    threads = qBound(1, threads, buckets.size());
+
+    if (threads == 1) {
+        renderTiles();
+        return image;
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    QVector<QFuture<void>> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.append(QtConcurrent::run(&pool, renderTiles));
+    }
+    for (QFuture<void>& worker : workers) {
+        worker.waitForFinished();
+    }
+    return image;
+}
+
+bool ExportRenderer::exportToFile(const RenderList& list, const QString& fileName,
+                                  const ExportOptions& options, QString* errorString) {
+    const QRectF source = sourceRectFor(list, options);
+    const QSizeF size = source.size() * options.scale;
+
+    auto fail = [errorString](const QString& message) {
+        if (errorString)
+            *errorString = message;
+        return false;
+    };
+
+    switch (formatForFile(fileName)) {
+    case ExportFormat::Svg: {
+        QSvgGenerator generator;
+        generator.setFileName(fileName);
+        generator.setSize(size.toSize());
+        generator.setViewBox(QRectF(QPointF(), size));
+        QPainter painter;
+        if (!painter.begin(&generator))
+            return fail(QStringLiteral("Cannot write %1").arg(fileName));
+        painter.fillRect(QRectF(QPointF(), size), options.background);
+        painter.scale(options.scale, options.scale);
+        painter.translate(-source.topLeft());
+        list.paint(&painter, source);
+        painter.end();
+        return true;
+    }
+    case ExportFormat::Pdf: {
+        QPdfWriter writer(fileName);
+        writer.setResolution(72); // Единица рисования - типографский пункт
+        writer.setPageSize(QPageSize(size, QPageSize::Point));
+        writer.setPageMargins(QMarginsF());
+        QPainter painter;
+        if (!painter.begin(&writer))
+            return fail(QStringLiteral("Cannot write %1").arg(fileName));
+        painter.scale(options.scale, options.scale);
+        painter.translate(-source.topLeft());
+        list.paint(&painter, source);
+        painter.end();
+        return true;
+    }
+    case ExportFormat::Png:
+    default: {
+        const QImage image = renderImage(list, options);
+        if (image.isNull())
+            return fail(QStringLiteral("Image is too large"));
+        QImageWriter writer(fileName, "png");
+        if (!writer.write(image))
+            return fail(writer.errorString());
+        return true;
+    }
+    }
+}
+
+int ExportRenderer::runCommandLine(const QStringList& arguments) {
+    const int index = arguments.indexOf(QStringLiteral("--export"));
+    if (index < 0 || index + 2 >= arguments.size()) {
+        qWarning("Usage: --export <document.shapes> <output.png|svg|pdf> [--scale N]");
+        return 2;
+    }
+
+    ExportOptions options;
+    const int scaleIndex = arguments.indexOf(QStringLiteral("--scale"));
+    if (scaleIndex >= 0 && scaleIndex + 1 < arguments.size())
+        options.scale = qMax(0.01, arguments.at(scaleIndex + 1).toDouble());
+
+    // Документ читается напрямую, без модели и сцены
+    ShapeDocument document;
+    if (!document.open(arguments.at(index + 1))) {
+        qWarning("%s", qPrintable(document.errorString()));
+        return 1;
+    }
+    QVector<Shape*> shapes;
+    shapes.reserve(document.shapeCount());
+    for (int i = 0; i < document.shapeCount(); ++i) {
+        Shape* shape = document.createShape(i);
+        if (shape)
+            shapes.append(shape);
+    }
+    const RenderList list = RenderList::snapshot(ShapeRange(shapes, shapes.size()));
+    qDeleteAll(shapes);
+
+    QString error;
+    if (!exportToFile(list, arguments.at(index + 2), options, &error)) {
+        qWarning("%s", qPrintable(error));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef EXPORTRENDERER_H
+#define EXPORTRENDERER_H
+
+#include <QColor>
+#include <QFont>
+#include <QPen>
+#include <QImage>
+#include <QRectF>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
+#include "shape.h"
+
+class GraphicModel;
+class ShapeRange;
+
+// Неизменяемый снимок фигур для отрисовки вне GUI-потока.
+// Копируется дешево (общие данные), читать можно из любых потоков.
+class RenderList {
+public:
+    struct Item {
+        ShapeType type;
+        QPointF startPos;
+        QPointF endPos;
+        QPointF pos;
+        QPen pen;
+        QFont font;
+        QString text;
+        QRectF bounds; // В координатах сцены
+    };
+
+    RenderList();
+    static RenderList snapshot(const ShapeRange& shapes); // Только в GUI-потоке
+
+    int size() const;
+    QRectF bounds() const;
+    // Рисует фигуры, пересекающие clip, в порядке добавления
+    void paint(QPainter* painter, const QRectF& clip) const;
+    void paintItem(QPainter* painter, int index) const;
+    const Item& item(int index) const;
+
+private:
+    struct Data;
+    QSharedPointer<const Data> d;
+};
+
+enum class ExportFormat { Png, Svg, Pdf };
+
+struct ExportOptions {
+    QRectF sourceRect;       // Пустой - все фигуры с полями
+    qreal scale = 1.0;       // Пикселей (точек) на единицу сцены
+    QColor background = Qt::white;
+    int tileSize = 512;      // Сторона тайла растра в пикселях
+    int threadCount = 0;     // 0 - по числу ядер
+};
+
+// Экспорт в PNG (параллельно по тайлам), SVG и PDF. Не трогает сцену и
+// виджеты, поэтому работает в фоновом потоке и без GUI.
+class ExportRenderer {
+public:
+    static ExportFormat formatForFile(const QString& fileName);
+    static bool exportToFile(const RenderList& list, const QString& fileName,
+                             const ExportOptions& options = ExportOptions(),
+                             QString* errorString = nullptr);
+    static QImage renderImage(const RenderList& list, const ExportOptions& options);
+
+    // Точка входа для запуска без окна:
+    //   --export <document.shapes> <output.png|svg|pdf> [--scale N]
+    // Возвращает код завершения процесса.
+    static int runCommandLine(const QStringList& arguments);
+
+private:
+    static QRectF sourceRectFor(const RenderList& list, const ExportOptions& options);
+};
+
+#endif // EXPORTRENDERER_H
@@ -0,0 +1,42 @@
+#include "framethrottle.h"
+
+FrameThrottle::FrameThrottle(QObject* parent)
+    : QObject(parent) {
+    timer.setSingleShot(true);
+    timer.setInterval(frameInterval);
+    timer.setTimerType(Qt::PreciseTimer);
+    connect(&timer, &QTimer::timeout, this, &FrameThrottle::onTimeout);
+}
+
+void FrameThrottle::request(const std::function<void()>& apply) {
+    if (timer.isActive()) {
+        pending = apply;
+        return;
+    }
+    apply();
+    timer.start();
+}
+
+void FrameThrottle::flush() {
+    timer.stop();
+    if (pending) {
+        std::function<void()> apply;
+        apply.swap(pending);
+        apply();
+    }
+}
+
+void FrameThrottle::cancel() {
+    timer.stop();
+    pending = nullptr;
+}
+
+void FrameThrottle::onTimeout() {
+    if (!pending)
+        return;
+
+    std::function<void()> apply;
+    apply.swap(pending);
+    apply();
+    timer.start();
+}
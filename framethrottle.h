@@ -0,0 +1,29 @@
+#ifndef FRAMETHROTTLE_H
+#define FRAMETHROTTLE_H
+
+#include <QObject>
+#include <QTimer>
+#include <functional>
+
+// Прореживает интерактивные обновления до одного за кадр.
+// Первое обновление применяется сразу, последующие в течение кадра
+// откладываются, и в конце кадра применяется только последнее.
+class FrameThrottle : public QObject {
+    Q_OBJECT
+public:
+    explicit FrameThrottle(QObject* parent = nullptr);
+
+    void request(const std::function<void()>& apply);
+    void flush();  // Применить отложенное обновление немедленно (например, при отпускании мыши)
+    void cancel();
+
+    static const int frameInterval = 16; // мс, ~60 кадров в секунду
+
+private:
+    void onTimeout();
+
+    QTimer timer;
+    std::function<void()> pending;
+};
+
+#endif // FRAMETHROTTLE_H
@@ -1,11 +1,30 @@
 #include "graphiccontroller.h"
-#include <QInputDialog>
+#include <QClipboard>
+#include <QGuiApplication>
+#include <QMimeData>
 #include "command.h"
+#include "modeljobs.h"
+#include "shapedocument.h"
+
+namespace {
+const char* const clipboardFormat = "application/x-shape-editor-shapes";
+const qreal pasteOffset = 20;
+const int pooledInsertSize = 4096; // С такой вставки фигуры готовятся в пуле
+}
 
 GraphicController::GraphicController(GraphicModel* model, QObject* parent)
-    : QObject(parent), model(model), currentMode(EditorMode::Select),
+    : QObject(parent), model(model), jobs(nullptr), currentMode(EditorMode::Select),
     currentColor(Qt::black), currentShape(nullptr), isDrawing(false),
-    isMoving(false), selectedShape(nullptr) {}
+    isSelectingArea(false), pasteCount(0) {
+    connect(model->getScene(), &CustomGraphicsScene::shapeResized,
+            this, &GraphicController::onShapeResized);
+    connect(model->getScene(), &CustomGraphicsScene::selectionMoved,
+            this, &GraphicController::onSelectionMoved);
+}
+
+GraphicController::~GraphicController() {
+    qDeleteAll(copiedShapes);
+}
 
 void GraphicController::setEditorMode(EditorMode mode) {
     currentMode = mode;
@@ -24,100 +43,226 @@ QColor GraphicController::getCurrentColor() const {
 }
 
 void GraphicController::changeSelectedItemsColor(const QColor& color) {
-    for (Shape* shape : model->getShapes()) {
-        if (shape->isSelected()) {
-            shape->setColor(color);
-        }
-    }
+    const QList<Shape*> selected = model->getSelectedShapes();
+    if (!selected.isEmpty())
+        model->pushCommand(new ColorCommand(model, selected, color));
+}
+
+void GraphicController::editSelectedText(const QString& text, const QFont& font) {
+    Shape* shape = model->firstSelected(ShapeType::Text);
+    if (!shape || text.isEmpty())
+        return;
+    if (shape->getText() != text || shape->getFont() != font)
+        model->pushCommand(new TextCommand(model, shape, text, font));
+}
+
+void GraphicController::addText(const QPointF& pos, const QString& text) {
+    if (text.isEmpty())
+        return;
+
+    Shape* shape = model->createShape(ShapeType::Text, pos, currentColor);
+    shape->setText(text);
+    model->pushCommand(new AddCommand(model, shape->getId()));
 }
 
 void GraphicController::mousePressed(const QPointF& pos) {
     if (currentMode == EditorMode::Select) {
-        QList<QGraphicsItem*> items = model->getScene()->items(pos);
-        for (QGraphicsItem* item : items) {
-            Shape* shape = dynamic_cast<Shape*>(item);
-            if (shape) {
-                isMoving = true;
-                selectedShape = shape;
-                lastPos = shape->pos(); // Запоминаем начальную позицию
-                return;
-            }
-        }
+        // Нажатие на фигуру сцена доставляет самой фигуре (она находится по
+        // индексу модели), сюда приходит только пустое место - рамка выделения
+        isSelectingArea = true;
+        areaStart = pos;
     }
     else {
+        ShapeType type;
         switch(currentMode) {
         case EditorMode::CreateLine:
-            model->addShape(ShapeType::Line, pos, currentColor);
+            type = ShapeType::Line;
             break;
         case EditorMode::CreateRect:
-            model->addShape(ShapeType::Rectangle, pos, currentColor);
+            type = ShapeType::Rectangle;
             break;
         case EditorMode::CreateEllipse:
-            model->addShape(ShapeType::Ellipse, pos, currentColor);
+            type = ShapeType::Ellipse;
             break;
         case EditorMode::CreateTriangle:
-            model->addShape(ShapeType::Triangle, pos, currentColor);
+            type = ShapeType::Triangle;
             break;
-        case EditorMode::CreateText: {
-            bool ok;
-            QString text = QInputDialog::getText(nullptr, "Enter Text", "Text:",
-                                                 QLineEdit::Normal, "", &ok);
-            if (ok && !text.isEmpty()) {
-                model->addShape(ShapeType::Text, pos, currentColor);
-                Shape* shape = model->getShapes().last();
-                shape->setText(text);
-            }
+        case EditorMode::CreateText:
+            emit textRequested(pos);
             return;
-        }
         default:
             return;
         }
 
-        currentShape = model->getShapes().last();
+        // Пока фигура рисуется, она на сцене, но не в истории: AddCommand
+        // кладется при отпускании, уже с итоговой геометрией, и журнал
+        // автосохранения записывает фигуру готовой
+        currentShape = model->createShape(type, pos, currentColor);
+        model->addShape(currentShape);
+        currentShape->setLive(true);
         isDrawing = true;
     }
 }
 
 void GraphicController::mouseMoved(const QPointF& pos) {
-    if (isMoving && selectedShape) {
-        selectedShape->setPos(pos - selectedShape->boundingRect().center());
+    if ((isDrawing && currentShape) || isSelectingArea) {
+        // Мышь может слать сотни событий за кадр - геометрию меняем раз в кадр
+        dragPos = pos;
+        model->getScene()->frameThrottle()->request([this]() { applyDrag(); });
+    }
+}
+
+void GraphicController::applyDrag() {
+    if (isSelectingArea) {
+        const QRectF area = QRectF(areaStart, dragPos).normalized();
+        model->getScene()->setRubberBand(area);
+        model->selectArea(area);
     }
     else if (isDrawing && currentShape) {
-        currentShape->setEndPos(pos);
+        currentShape->setEndPos(dragPos);
     }
 }
 
+void GraphicController::onShapeResized(Shape* shape, const QPointF& oldStart,
+                                       const QPointF& oldEnd) {
+    if (model->contains(shape))
+        model->pushCommand(new ResizeCommand(model, shape, oldStart, oldEnd));
+}
+
+void GraphicController::onSelectionMoved(const QList<Shape*>& shapes,
+                                         const QVector<QPointF>& oldPositions,
+                                         const QPointF& delta) {
+    // Позиции уже применены во время перетаскивания, redo при push их не меняет
+    model->pushCommand(new MoveShapesCommand(model, shapes, oldPositions, delta));
+}
+
 void GraphicController::mouseReleased() {
-    if (isMoving && selectedShape) {
-        // Добавляем команду перемещения в стек отмены
-        model->getUndoStack()->push(new MoveCommand(model, selectedShape,
-                                                    lastPos, selectedShape->pos()));
+    model->getScene()->frameThrottle()->flush();
+    if (currentShape) {
+        currentShape->setLive(false);
+        // Фигуру могли удалить (Delete), не отпуская кнопку мыши
+        if (isDrawing && model->contains(currentShape))
+            model->pushCommand(new AddCommand(model, currentShape->getId()));
     }
+    if (isSelectingArea)
+        model->getScene()->setRubberBand(QRectF());
     isDrawing = false;
-    isMoving = false;
+    isSelectingArea = false;
     currentShape = nullptr;
-    selectedShape = nullptr;
 }
 
 void GraphicController::deleteSelectedItems() {
-    QList<Shape*> toRemove;
-    // Сначала собираем все выделенные фигуры
-    for (Shape* shape : model->getShapes()) {
-        if (shape->isSelected()) {
-            toRemove.append(shape);
-        }
-    }
+    // Копия: удаление меняет выделение
+    const QList<Shape*> toRemove = model->getSelectedShapes();
 
     // Создаем одну команду для всех удалений
     if (!toRemove.isEmpty()) {
-        model->getUndoStack()->beginMacro("Delete shapes");
-        for (Shape* shape : toRemove) {
-            new DeleteCommand(model, shape); // Команда сама удалит фигуру
-        }
-        model->getUndoStack()->endMacro();
+        model->pushCommand(new DeleteShapesCommand(model, toRemove));
     }
 }
 
 void GraphicController::clearAll() {
     model->clear();
 }
+
+void GraphicController::setJobs(ModelJobs* jobs) {
+    if (this->jobs)
+        disconnect(this->jobs, nullptr, this, nullptr);
+    this->jobs = jobs;
+    if (jobs)
+        connect(jobs, &ModelJobs::importFinished, this, &GraphicController::selectShapes);
+}
+
+void GraphicController::copySelection() {
+    const QList<Shape*> selected = model->getSelectedShapesInStackingOrder();
+    if (selected.isEmpty())
+        return;
+
+    qDeleteAll(copiedShapes);
+    copiedShapes.clear();
+    copiedShapes.reserve(selected.size());
+    for (Shape* shape : selected) {
+        copiedShapes.append(shape->clone());
+    }
+    const QVector<Shape*> range = selected.toVector();
+    copiedBytes = ShapeDocument::serialize(ShapeRange(range, range.size()));
+    pasteCount = 0;
+
+    QMimeData* mimeData = new QMimeData;
+    mimeData->setData(clipboardFormat, copiedBytes);
+    QGuiApplication::clipboard()->setMimeData(mimeData);
+}
+
+void GraphicController::cutSelection() {
+    copySelection();
+    deleteSelectedItems();
+}
+
+void GraphicController::paste() {
+    const QMimeData* mimeData = QGuiApplication::clipboard()->mimeData();
+    if (!mimeData || !mimeData->hasFormat(clipboardFormat))
+        return;
+
+    const QByteArray bytes = mimeData->data(clipboardFormat);
+    const qreal offset = pasteOffset * ++pasteCount;
+    QList<Shape*> pasted;
+
+    if (bytes == copiedBytes) {
+        // Скопировано в этом окне: клоны снимка делят с ним неявно общие данные
+        for (const Shape* shape : qAsConst(copiedShapes)) {
+            pasted.append(shape->clone());
+        }
+    } else {
+        ShapeDocument document;
+        if (!document.openData(bytes)) {
+            qWarning("GraphicController: clipboard: %s", qPrintable(document.errorString()));
+            return;
+        }
+        // Записи большого буфера разбираются в пуле вместе с раскладкой текста
+        if (jobs && document.shapeCount() >= pooledInsertSize) {
+            jobs->importData(bytes, QPointF(offset, offset));
+            return;
+        }
+        for (int i = 0; i < document.shapeCount(); ++i) {
+            Shape* shape = document.createShape(i);
+            if (shape)
+                pasted.append(shape);
+        }
+    }
+
+    insertShapes(pasted, QPointF(offset, offset));
+}
+
+void GraphicController::duplicateSelection() {
+    QList<Shape*> duplicates;
+    for (const Shape* shape : model->getSelectedShapesInStackingOrder()) {
+        duplicates.append(shape->clone());
+    }
+    insertShapes(duplicates, QPointF(pasteOffset, pasteOffset));
+}
+
+void GraphicController::insertShapes(const QList<Shape*>& shapes, const QPointF& offset) {
+    if (shapes.isEmpty())
+        return;
+
+    // Сдвиг и контуры попадания большой вставки считаются в пуле,
+    // выделяется она по ModelJobs::importFinished
+    if (jobs && shapes.size() >= pooledInsertSize) {
+        jobs->importShapes(shapes, offset);
+        return;
+    }
+
+    for (Shape* shape : shapes) {
+        shape->moveBy(offset.x(), offset.y());
+    }
+    // Одна команда AddShapesCommand, фигуры добавляются пакетом
+    model->importShapes(shapes);
+    selectShapes(shapes);
+}
+
+void GraphicController::selectShapes(const QList<Shape*>& shapes) {
+    model->getScene()->clearSelection();
+    for (Shape* shape : shapes) {
+        shape->setSelected(true);
+    }
+}
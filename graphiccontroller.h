@@ -6,18 +6,27 @@
 #include "graphicmodel.h"
 #include "shape.h"
 
+class ModelJobs;
+
 enum class EditorMode { Select, CreateLine, CreateRect, CreateEllipse, CreateText, CreateTriangle };
 
 class GraphicController : public QObject {
     Q_OBJECT
 public:
     explicit GraphicController(GraphicModel* model, QObject* parent = nullptr);
+    ~GraphicController() override;
 
     void setEditorMode(EditorMode mode);
     void setCurrentColor(const QColor& color);
     void setCurrentText(const QString& text);
     QColor getCurrentColor() const;
     void changeSelectedItemsColor(const QColor& color);
+    // Текст и шрифт первой выделенной надписи, одной командой отмены
+    void editSelectedText(const QString& text, const QFont& font);
+
+    // Текст для новой надписи запрашивает окно (сигнал textRequested),
+    // сам контроллер диалогов не показывает
+    void addText(const QPointF& pos, const QString& text);
 
     void mousePressed(const QPointF& pos);
     void mouseMoved(const QPointF& pos);
@@ -26,16 +35,41 @@ public:
     void deleteSelectedItems();
     void clearAll();
 
+    // Буфер обмена в двоичном формате ShapeDocument. Внутри редактора вставка
+    // клонирует снимок, сделанный при копировании: копии делят геометрию и
+    // текст с оригиналом до первого изменения. Вставка и дублирование -
+    // одна команда отмены. Большие вставки готовятся в пуле jobs (если он
+    // задан) и выделяются, когда фигуры попадут в модель.
+    void setJobs(ModelJobs* jobs);
+    void copySelection();
+    void cutSelection();
+    void paste();
+    void duplicateSelection();
+
+signals:
+    void textRequested(const QPointF& pos);
+
 private:
+    void applyDrag();
+    void insertShapes(const QList<Shape*>& shapes, const QPointF& offset);
+    void selectShapes(const QList<Shape*>& shapes);
+    void onShapeResized(Shape* shape, const QPointF& oldStart, const QPointF& oldEnd);
+    void onSelectionMoved(const QList<Shape*>& shapes, const QVector<QPointF>& oldPositions,
+                          const QPointF& delta);
+
     GraphicModel* model;
+    ModelJobs* jobs;
     EditorMode currentMode;
     QColor currentColor;
     QString currentText;
     Shape* currentShape;
     bool isDrawing;
-    bool isMoving;
-    Shape* selectedShape;
-    QPointF lastPos;
+    bool isSelectingArea;
+    QPointF areaStart;
+    QPointF dragPos; // Последняя позиция мыши, применяется не чаще раза в кадр
+    QList<Shape*> copiedShapes; // Снимок выделения на момент копирования, вне модели
+    QByteArray copiedBytes;     // То же, что положено в буфер обмена
+    int pasteCount;             // Каждая следующая вставка сдвигается дальше
 };
 
 #endif // GRAPHICCONTROLLER_H
@@ -1,47 +1,527 @@
 #include "graphicmodel.h"
+#include <algorithm>
 #include "command.h"
+#include "profiler.h"
+#include "shapedocument.h"
+#include "shapepool.h"
 
-GraphicModel::GraphicModel(QObject* parent) : QObject(parent) {
+namespace {
+const qint64 defaultHistoryBudget = 32 * 1024 * 1024;
+const int minUndoLimit = 16;
+}
+
+QList<Shape*> ShapeRange::toList() const {
+    QList<Shape*> result;
+    result.reserve(count);
+    for (Shape* shape : *this) {
+        result.append(shape);
+    }
+    return result;
+}
+
+GraphicModel::GraphicModel(QObject* parent)
+    : QObject(parent), freeSlots(0), topZ(0), slotsUnordered(false),
+    spatialIndex(SpatialIndex::create(SpatialIndexType::RTree)), nextShapeId(1), historyBytes(0),
+    historyBudget(defaultHistoryBudget), batchDepth(0), batchChanged(false),
+    selectionDirty(false) {
     scene = new CustomGraphicsScene(this);
     scene->setSceneRect(-500, -500, 1000, 1000);
+    scene->setShapePicker([this](const QPointF& pos) { return shapeAt(pos); });
+    connect(scene, &QGraphicsScene::selectionChanged, this, [this]() {
+        selectionDirty = true;
+    });
     undoStack = new QUndoStack(this);
 }
 
 GraphicModel::~GraphicModel() {
     clear();
+    delete spatialIndex;
 }
 
 void GraphicModel::addShape(ShapeType type, const QPointF& startPos, const QColor& color) {
-    Shape* shape = new Shape(type, startPos, color);
-    undoStack->push(new AddCommand(this, type, startPos, color));
+    Shape* shape = createShape(type, startPos, color);
+    pushCommand(new AddCommand(this, shape->getId()));
+    PROFILE_SCOPE("sceneUpdated");
     emit sceneUpdated();
 }
 
+Shape* GraphicModel::createShape(ShapeType type, const QPointF& startPos, const QColor& color) {
+    Shape* shape = new Shape(type, startPos, color);
+    adoptShape(shape);
+    return shape;
+}
+
+void GraphicModel::adoptShape(Shape* shape) {
+    shape->owner = this;
+    // Идентификатор назначается один раз и сохраняется при undo/redo и в файле
+    if (shape->shapeId == 0) {
+        shape->shapeId = nextShapeId++;
+    } else if (shape->shapeId >= nextShapeId) {
+        nextShapeId = shape->shapeId + 1;
+    }
+
+    Shape* previous = ownedShapes.value(shape->shapeId);
+    if (previous && previous != shape) {
+        qWarning("GraphicModel: duplicate shape id %u", shape->shapeId);
+        shape->shapeId = nextShapeId++;
+    }
+    ownedShapes.insert(shape->shapeId, shape);
+}
+
+void GraphicModel::destroyShape(Shape* shape) {
+    if (!shape || ownedShapes.value(shape->shapeId) != shape)
+        return;
+
+    removeShape(shape);
+    ownedShapes.remove(shape->shapeId);
+    delete shape;
+}
+
+Shape* GraphicModel::shapeById(quint32 id) const {
+    return ownedShapes.value(id);
+}
+
 void GraphicModel::addShape(Shape* shape) {
+    if (contains(shape))
+        return;
+
+    if (ownedShapes.value(shape->shapeId) != shape)
+        adoptShape(shape);
+
+    // Новая фигура ложится наверх; возвращенная (undo удаления, redo
+    // добавления) сохраняет свой z и с ним место в порядке наложения
+    if (shape->zValue() <= 0)
+        shape->setZValue(++topZ);
+    else if (shape->zValue() < topZ)
+        slotsUnordered = true;
+    else
+        topZ = shape->zValue();
+
+    shape->modelSlot = shapes.size();
     shapes.append(shape);
     scene->addItem(shape);
-    emit sceneUpdated();
+    indexShape(shape);
+    if (slotsUnordered && batchDepth == 0)
+        orderSlots();
+    notifySceneUpdated();
 }
 
 void GraphicModel::removeShape(Shape* shape) {
-    if (shapes.removeOne(shape)) {
-        scene->removeItem(shape);
+    if (!contains(shape))
+        return;
+
+    scene->cancelSelectionMove();
+    indexDirty.remove(shape);
+    spatialIndex->remove(shape, shape->indexedRect);
+    shapes[shape->modelSlot] = nullptr;
+    shape->modelSlot = -1;
+    ++freeSlots;
+    scene->removeItem(shape);
+
+    // Уплотняем, когда дыр стало больше половины
+    if (freeSlots > 64 && freeSlots * 2 > shapes.size()) {
+        compactSlots();
+    }
+    notifySceneUpdated();
+}
+
+void GraphicModel::addShapes(const QList<Shape*>& newShapes) {
+    if (newShapes.isEmpty())
+        return;
+
+    beginBatch();
+    shapes.reserve(shapes.size() + newShapes.size());
+    for (Shape* shape : newShapes) {
+        addShape(shape);
+    }
+    endBatch();
+}
+
+void GraphicModel::removeShapes(const QList<Shape*>& oldShapes) {
+    if (oldShapes.isEmpty())
+        return;
+
+    beginBatch();
+    for (Shape* shape : oldShapes) {
+        removeShape(shape);
+    }
+    endBatch();
+}
+
+void GraphicModel::importShapes(const QList<Shape*>& newShapes, const QRectF& bounds) {
+    if (newShapes.isEmpty())
+        return;
+
+    if (!bounds.isNull())
+        growSceneRect(bounds);
+
+    QVector<quint32> ids;
+    ids.reserve(newShapes.size());
+    for (Shape* shape : newShapes) {
+        shape->shapeId = 0; // id из буфера обмена или исходной фигуры уже заняты
+        adoptShape(shape);
+        ids.append(shape->getId());
+    }
+    pushCommand(new AddShapesCommand(this, ids));
+}
+
+void GraphicModel::pushCommand(ShapeCommand* command) {
+    PROFILE_SCOPE("GraphicModel::pushCommand");
+    // Стоимость считается после redo(): только тогда видно, какие фигуры
+    // сняты со сцены и держатся одной историей
+    undoStack->push(command);
+
+    // Слитая команда уже удалена; отброшенные redo-команды и вытесненные
+    // лимитом вычитают себя в деструкторе ShapeCommand
+    const int index = undoStack->index();
+    if (index > 0 && undoStack->command(index - 1) == command) {
+        qint64 cost = command->memoryCost();
+        for (int i = 0; i < command->childCount(); ++i) {
+            const ShapeCommand* child = dynamic_cast<const ShapeCommand*>(command->child(i));
+            if (child)
+                cost += child->memoryCost();
+        }
+        command->accountedBytes = cost;
+        historyBytes += cost;
+    }
+
+    if (historyBytes > historyBudget)
+        compactHistory();
+}
+
+void GraphicModel::undo() {
+    undoStack->undo();
+    // Под командой могли остаться сжатые (устаревшие) - они удаляются без
+    // отмены, иначе следующий undo() выглядел бы пустым
+    while (undoStack->index() > 0 && undoStack->command(undoStack->index() - 1)->isObsolete())
+        undoStack->undo();
+}
+
+void GraphicModel::setHistoryMemoryBudget(qint64 bytes) {
+    historyBudget = bytes;
+    if (historyBytes > historyBudget)
+        compactHistory();
+}
+
+qint64 GraphicModel::historyMemoryBudget() const {
+    return historyBudget;
+}
+
+qint64 GraphicModel::historyMemoryUsage() const {
+    return historyBytes;
+}
+
+void GraphicModel::compactHistory() {
+    // QUndoStack не удаляет отдельные команды, поэтому самые старые выполненные
+    // команды отдают свою память и становятся устаревшими (discard()). Последние
+    // minUndoLimit команд, включая только что добавленную, не трогаются.
+    const int last = undoStack->index() - minUndoLimit;
+    for (int i = 0; i < last && historyBytes > historyBudget; ++i) {
+        ShapeCommand* command = dynamic_cast<ShapeCommand*>(
+            const_cast<QUndoCommand*>(undoStack->command(i)));
+        if (command && !command->isObsolete())
+            command->discard();
+    }
+}
+
+void GraphicModel::releaseHistoryBytes(qint64 bytes) {
+    historyBytes -= bytes;
+    Q_ASSERT(historyBytes >= 0);
+}
+
+void GraphicModel::beginBatch() {
+    ++batchDepth;
+}
+
+void GraphicModel::endBatch() {
+    Q_ASSERT(batchDepth > 0);
+    if (--batchDepth > 0)
+        return;
+    if (slotsUnordered)
+        orderSlots();
+    if (batchChanged) {
+        batchChanged = false;
+        PROFILE_SCOPE("sceneUpdated");
+        emit sceneUpdated();
+    }
+}
+
+void GraphicModel::notifySceneUpdated() {
+    if (batchDepth > 0) {
+        batchChanged = true;
+    } else {
+        PROFILE_SCOPE("sceneUpdated");
         emit sceneUpdated();
     }
 }
 
 void GraphicModel::clear() {
+    clearShapes();
+    notifySceneUpdated();
+    emit modelReset();
+}
+
+void GraphicModel::clearShapes() {
     undoStack->clear();
-    for (Shape* shape : shapes) {
-        scene->removeItem(shape);
-        delete shape;
+
+    // Снятые со сцены фигуры удаляем сами, остальные сцена удалит разом:
+    // clear() не перестраивает индекс после каждого элемента
+    for (Shape* shape : qAsConst(ownedShapes)) {
+        if (!contains(shape))
+            delete shape;
     }
+    ownedShapes.clear();
+    spatialIndex->clear();
+    indexDirty.clear();
     shapes.clear();
-    emit sceneUpdated();
+    freeSlots = 0;
+    topZ = 0;
+    slotsUnordered = false;
+    selectedShapes.clear();
+    selectedByType.clear();
+    selectionDirty = false;
+    scene->cancelSelectionMove();
+    scene->clear();
+    scene->invalidateAllTiles(); // Удаление элементов в clear() не проходит через itemChange
+
+    // Все блоки пула свободны, возвращаем память целиком
+    ShapePool::trim();
 }
 
-QList<Shape*> GraphicModel::getShapes() const {
-    return shapes;
+bool GraphicModel::save(const QString& fileName, QString* errorString) const {
+    return ShapeDocument::save(fileName, getShapes(), errorString);
+}
+
+bool GraphicModel::load(const QString& fileName, QString* errorString) {
+    ShapeDocument document;
+    if (!document.open(fileName)) {
+        if (errorString)
+            *errorString = document.errorString();
+        return false;
+    }
+
+    QList<Shape*> loaded;
+    loaded.reserve(document.shapeCount());
+    for (int i = 0; i < document.shapeCount(); ++i) {
+        Shape* shape = document.createShape(i);
+        if (shape)
+            loaded.append(shape);
+    }
+    resetShapes(loaded);
+    return true;
+}
+
+void GraphicModel::resetShapes(const QList<Shape*>& loaded) {
+    // modelReset один раз, когда новый документ уже на месте
+    beginBatch();
+    clearShapes();
+    notifySceneUpdated();
+    addShapes(loaded);
+    endBatch();
+    emit modelReset();
+}
+
+void GraphicModel::compactSlots() {
+    int next = 0;
+    for (Shape* shape : shapes) {
+        if (shape) {
+            shape->modelSlot = next;
+            shapes[next++] = shape;
+        }
+    }
+    shapes.resize(next);
+    freeSlots = 0;
+}
+
+void GraphicModel::orderSlots() {
+    // Слоты идут в порядке наложения - в нем фигуры сохраняются в документ
+    slotsUnordered = false;
+    compactSlots();
+    std::stable_sort(shapes.begin(), shapes.end(), [](const Shape* a, const Shape* b) {
+        return a->zValue() < b->zValue();
+    });
+    for (int i = 0; i < shapes.size(); ++i) {
+        shapes.at(i)->modelSlot = i;
+    }
+}
+
+void GraphicModel::setSpatialIndexType(SpatialIndexType type) {
+    if (type == spatialIndex->type())
+        return;
+
+    delete spatialIndex;
+    spatialIndex = SpatialIndex::create(type);
+    indexDirty.clear();
+    for (Shape* shape : getShapes()) {
+        indexShape(shape);
+    }
+}
+
+SpatialIndexType GraphicModel::spatialIndexType() const {
+    return spatialIndex->type();
+}
+
+Shape* GraphicModel::shapeAt(const QPointF& pos) const {
+    const QList<Shape*> hits = shapesAt(pos);
+    return hits.isEmpty() ? nullptr : hits.first();
+}
+
+QList<Shape*> GraphicModel::shapesAt(const QPointF& pos) const {
+    flushSpatialIndex();
+    QVector<Shape*> candidates;
+    spatialIndex->query(QRectF(pos, QSizeF(0, 0)), candidates);
+
+    QList<Shape*> hits;
+    for (Shape* shape : candidates) {
+        if (shape->contains(shape->mapFromScene(pos)))
+            hits.append(shape);
+    }
+    sortByStacking(hits);
+    return hits;
+}
+
+QList<Shape*> GraphicModel::shapesInRect(const QRectF& rect, Qt::ItemSelectionMode mode) const {
+    flushSpatialIndex();
+    QVector<Shape*> candidates;
+    spatialIndex->query(rect, candidates);
+
+    QPainterPath area;
+    area.addRect(rect);
+    QList<Shape*> hits;
+    for (Shape* shape : candidates) {
+        // Для режимов Contains достаточно ограничивающего прямоугольника
+        bool hit = rect.contains(shape->sceneBoundingRect());
+        if (!hit && mode == Qt::IntersectsItemBoundingRect) {
+            hit = true; // Кандидаты индекса уже пересекают прямоугольник
+        } else if (!hit && mode == Qt::IntersectsItemShape) {
+            hit = shape->collidesWithPath(shape->mapFromScene(area), mode);
+        }
+        if (hit)
+            hits.append(shape);
+    }
+    sortByStacking(hits);
+    return hits;
+}
+
+QList<Shape*> GraphicModel::nearestShapes(const QPointF& pos, int count) const {
+    flushSpatialIndex();
+    return spatialIndex->nearest(pos, count).toList();
+}
+
+void GraphicModel::selectArea(const QRectF& rect) {
+    const QList<Shape*> hits = shapesInRect(rect);
+    const QSet<Shape*> wanted(hits.begin(), hits.end());
+
+    // Снимаем и ставим выделение только там, где оно меняется
+    const QList<Shape*> previous = getSelectedShapes();
+    for (Shape* shape : previous) {
+        if (!wanted.contains(shape))
+            shape->setSelected(false);
+    }
+    for (Shape* shape : hits) {
+        if (!shape->isSelected())
+            shape->setSelected(true);
+    }
+}
+
+void GraphicModel::shapeGeometryChanged(Shape* shape) {
+    if (contains(shape))
+        indexDirty.insert(shape);
+}
+
+void GraphicModel::flushSpatialIndex() const {
+    if (indexDirty.isEmpty())
+        return;
+    PROFILE_SCOPE("GraphicModel::flushSpatialIndex");
+
+    for (Shape* shape : qAsConst(indexDirty)) {
+        spatialIndex->remove(shape, shape->indexedRect);
+        indexShape(shape);
+    }
+    indexDirty.clear();
+}
+
+void GraphicModel::indexShape(Shape* shape) const {
+    PROFILE_SCOPE("GraphicModel::indexShape");
+    shape->indexedRect = shape->sceneBoundingRect();
+    spatialIndex->insert(shape, shape->indexedRect);
+    growSceneRect(shape->indexedRect);
+}
+
+void GraphicModel::growSceneRect(const QRectF& rect) const {
+    // Область сцены растет вместе с содержимым, с запасом, чтобы BSP сцены
+    // не перестраивался на каждую фигуру за краем
+    const QRectF sceneRect = scene->sceneRect();
+    if (!sceneRect.contains(rect)) {
+        const qreal margin = qMax(sceneRect.width(), sceneRect.height()) / 2;
+        scene->setSceneRect(sceneRect.united(rect).adjusted(-margin, -margin, margin, margin));
+    }
+}
+
+void GraphicModel::sortByStacking(QList<Shape*>& hits) const {
+    // z у каждой фигуры свой (addShape), сверху - больший
+    std::sort(hits.begin(), hits.end(), [](const Shape* a, const Shape* b) {
+        return a->zValue() > b->zValue();
+    });
+}
+
+bool GraphicModel::contains(const Shape* shape) const {
+    return shape && shape->modelSlot >= 0 && shape->modelSlot < shapes.size()
+           && shapes.at(shape->modelSlot) == shape;
+}
+
+int GraphicModel::shapeCount() const {
+    return shapes.size() - freeSlots;
+}
+
+ShapeRange GraphicModel::getShapes() const {
+    return ShapeRange(shapes, shapeCount());
+}
+
+Shape* GraphicModel::lastAdded() const {
+    for (int i = shapes.size() - 1; i >= 0; --i) {
+        if (shapes.at(i))
+            return shapes.at(i);
+    }
+    return nullptr;
+}
+
+const QList<Shape*>& GraphicModel::getSelectedShapes() const {
+    updateSelection();
+    return selectedShapes;
+}
+
+QList<Shape*> GraphicModel::getSelectedShapesInStackingOrder() const {
+    QList<Shape*> selected = getSelectedShapes();
+    std::reverse(selected.begin(), selected.end());
+    return selected;
+}
+
+Shape* GraphicModel::firstSelected(ShapeType type) const {
+    updateSelection();
+    const QList<Shape*> shapesOfType = selectedByType.value(static_cast<int>(type));
+    return shapesOfType.isEmpty() ? nullptr : shapesOfType.first();
+}
+
+void GraphicModel::updateSelection() const {
+    if (!selectionDirty)
+        return;
+
+    // selectedItems() у сцены работает за размер выделения, а не всей сцены,
+    // но порядок у него произвольный - сортируем сверху вниз, чтобы
+    // firstSelected() всегда давал верхнюю фигуру
+    selectedShapes.clear();
+    selectedByType.clear();
+    for (QGraphicsItem* item : scene->selectedItems()) {
+        Shape* shape = dynamic_cast<Shape*>(item);
+        if (shape)
+            selectedShapes.append(shape);
+    }
+    sortByStacking(selectedShapes);
+    for (Shape* shape : qAsConst(selectedShapes)) {
+        selectedByType[static_cast<int>(shape->getType())].append(shape);
+    }
+    selectionDirty = false;
 }
 
 CustomGraphicsScene* GraphicModel::getScene() const {
@@ -4,8 +4,49 @@
 #include <QObject>
 #include <QUndoStack>
 #include <QList>
+#include <QVector>
+#include <QHash>
+#include <QSet>
 #include "customgraphicsscene.h"
 #include "shape.h"
+#include "spatialindex.h"
+
+class ShapeCommand;
+
+// Непрерывный просмотр фигур модели без копирования.
+// Действителен до следующего изменения модели.
+class ShapeRange {
+public:
+    class const_iterator {
+    public:
+        const_iterator(Shape* const* it, Shape* const* end) : it(it), end(end) { skipFreeSlots(); }
+
+        Shape* operator*() const { return *it; }
+        const_iterator& operator++() { ++it; skipFreeSlots(); return *this; }
+        bool operator==(const const_iterator& other) const { return it == other.it; }
+        bool operator!=(const const_iterator& other) const { return it != other.it; }
+
+    private:
+        void skipFreeSlots() { while (it != end && !*it) ++it; }
+
+        Shape* const* it;
+        Shape* const* end;
+    };
+
+    ShapeRange(const QVector<Shape*>& slots, int count)
+        : first(slots.constData()), last(slots.constData() + slots.size()), count(count) {}
+
+    const_iterator begin() const { return const_iterator(first, last); }
+    const_iterator end() const { return const_iterator(last, last); }
+    int size() const { return count; }
+    bool isEmpty() const { return count == 0; }
+    QList<Shape*> toList() const;
+
+private:
+    Shape* const* first;
+    Shape* const* last;
+    int count;
+};
 
 class GraphicModel : public QObject {
     Q_OBJECT
@@ -14,21 +55,104 @@ public:
     ~GraphicModel();
 
     void addShape(ShapeType type, const QPointF& startPos, const QColor& color);
+
+    // Модель владеет всеми фигурами: и на сцене, и снятыми с нее (их держат
+    // команды отмены по id). Удаляются фигуры только через destroyShape() или clear().
+    Shape* createShape(ShapeType type, const QPointF& startPos, const QColor& color);
+    void adoptShape(Shape* shape);
+    void destroyShape(Shape* shape);
+    Shape* shapeById(quint32 id) const;
+
     void addShape(Shape* shape);
-    void removeShape(Shape* shape);
+    void removeShape(Shape* shape); // Снимает со сцены, но не удаляет
+    void addShapes(const QList<Shape*>& newShapes);
+    void removeShapes(const QList<Shape*>& oldShapes);
+    // Новые фигуры (вставка, дублирование) получают свежие id и
+    // добавляются одной командой AddShapesCommand. Заранее посчитанные
+    // границы (ModelJobs) расширяют область сцены один раз для всех фигур
+    void importShapes(const QList<Shape*>& newShapes, const QRectF& bounds = QRectF());
     void clear();
 
-    QList<Shape*> getShapes() const;
+    bool save(const QString& fileName, QString* errorString = nullptr) const;
+    bool load(const QString& fileName, QString* errorString = nullptr);
+    // Заменяет документ готовыми фигурами (их строит, например, ModelJobs)
+    void resetShapes(const QList<Shape*>& loaded);
+
+    // Все команды попадают в стек через pushCommand(), чтобы учитывать их память.
+    // При превышении бюджета старые команды отдают память и перестают отменяться.
+    void pushCommand(ShapeCommand* command);
+    void undo(); // Отменяет команду и убирает сжатые под ней
+    void setHistoryMemoryBudget(qint64 bytes);
+    qint64 historyMemoryBudget() const;
+    qint64 historyMemoryUsage() const;
+    void compactHistory();
+
+    // Пакетный режим: sceneUpdated испускается один раз в endBatch()
+    void beginBatch();
+    void endBatch();
+
+    // Поиск по собственному пространственному индексу модели, а не по BSP сцены.
+    // Результаты проверяются по форме фигуры; верхние фигуры идут первыми.
+    void setSpatialIndexType(SpatialIndexType type);
+    SpatialIndexType spatialIndexType() const;
+    Shape* shapeAt(const QPointF& pos) const;
+    QList<Shape*> shapesAt(const QPointF& pos) const;
+    QList<Shape*> shapesInRect(const QRectF& rect,
+                               Qt::ItemSelectionMode mode = Qt::IntersectsItemShape) const;
+    QList<Shape*> nearestShapes(const QPointF& pos, int count) const;
+    void selectArea(const QRectF& rect); // Выделяет ровно фигуры в прямоугольнике
+
+    bool contains(const Shape* shape) const;
+    int shapeCount() const;
+    ShapeRange getShapes() const;
+    Shape* lastAdded() const;
+    const QList<Shape*>& getSelectedShapes() const; // Сверху вниз
+    QList<Shape*> getSelectedShapesInStackingOrder() const; // Снизу вверх
+    Shape* firstSelected(ShapeType type) const; // Верхняя выделенная фигура типа
     CustomGraphicsScene* getScene() const;
     QUndoStack* getUndoStack() const;
 
 signals:
     void sceneUpdated();
+    void modelReset(); // Документ заменен целиком: clear() или load()
 
 private:
+    friend class ShapeCommand;
+    friend class Shape;
+    void shapeGeometryChanged(Shape* shape);
+    void flushSpatialIndex() const;
+    void indexShape(Shape* shape) const;
+    void growSceneRect(const QRectF& rect) const;
+    void sortByStacking(QList<Shape*>& shapes) const;
+    void releaseHistoryBytes(qint64 bytes);
+    void notifySceneUpdated();
+    void clearShapes(); // clear() без сигналов
+    void compactSlots();
+    void orderSlots(); // Сортирует слоты по z после возврата фигур в середину стопки
+    void updateSelection() const;
+
     CustomGraphicsScene* scene;
-    QList<Shape*> shapes;
+    // Фигуры в порядке наложения (по z); удалённые оставляют nullptr до уплотнения,
+    // чтобы удаление по Shape::modelSlot было O(1) и сохраняло порядок.
+    QVector<Shape*> shapes;
+    int freeSlots;
+    qreal topZ; // z верхней фигуры, новые получают следующий
+    bool slotsUnordered;
+    QHash<quint32, Shape*> ownedShapes;
+    // Изменения геометрии копятся и применяются к индексу перед запросом
+    SpatialIndex* spatialIndex;
+    mutable QSet<Shape*> indexDirty;
+    quint32 nextShapeId;
     QUndoStack* undoStack;
+    qint64 historyBytes;
+    qint64 historyBudget;
+    int batchDepth;
+    bool batchChanged;
+
+    // Индекс выделения, пересобирается лениво после selectionChanged
+    mutable QList<Shape*> selectedShapes;
+    mutable QHash<int, QList<Shape*>> selectedByType;
+    mutable bool selectionDirty;
 };
 
 #endif // GRAPHICMODEL_H
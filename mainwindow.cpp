@@ -1,21 +1,40 @@
 #include "mainwindow.h"
+#include <QFileDialog>
+#include <QFontDatabase>
+#include <QMessageBox>
+#include <QStandardPaths>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include "exportrenderer.h"
+#include "modeljobs.h"
+#include "profiler.h"
+#include "sessionrecorder.h"
 
-MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent) {
+MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent), recorder(nullptr),
+    performanceHud(nullptr), performanceHudTimer(nullptr) {
     model = new GraphicModel(this);
     controller = new GraphicController(model, this);
+    jobs = new ModelJobs(model, this);
+    controller->setJobs(jobs);
 
     setupUI();
     setupToolBar();
     setupConnections();
+    setupAutosave();
 }
 
-MainWindow::~MainWindow() {}
+MainWindow::~MainWindow() {
+    // Журнал и фоновые задания останавливаются раньше модели, пока она еще цела
+    delete autosave;
+    delete jobs;
+}
 
 void MainWindow::setupUI() {
     view = new QGraphicsView(this);
     view->setScene(model->getScene());
     view->setRenderHint(QPainter::Antialiasing);
-    view->setDragMode(QGraphicsView::RubberBandDrag);
+    // Рамку выделения ведет контроллер по индексу модели
+    view->setDragMode(QGraphicsView::NoDrag);
     view->setInteractive(true);
     setCentralWidget(view);
 
@@ -36,11 +55,47 @@ void MainWindow::setupToolBar() {
     toolBar->addSeparator();
     QAction* deleteAction = toolBar->addAction("Delete");
     QAction* clearAction = toolBar->addAction("Clear");
+    QAction* copyAction = toolBar->addAction("Copy");
+    copyAction->setShortcut(QKeySequence::Copy);
+    QAction* cutAction = toolBar->addAction("Cut");
+    cutAction->setShortcut(QKeySequence::Cut);
+    QAction* pasteAction = toolBar->addAction("Paste");
+    pasteAction->setShortcut(QKeySequence::Paste);
+    QAction* duplicateAction = toolBar->addAction("Duplicate");
+    duplicateAction->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_D));
+
+    toolBar->addSeparator();
+    QAction* openAction = toolBar->addAction("Open");
+    QAction* saveAction = toolBar->addAction("Save");
+    QAction* exportAction = toolBar->addAction("Export");
 
     toolBar->addSeparator();
     QAction* undoAction = toolBar->addAction("Undo");
     QAction* redoAction = toolBar->addAction("Redo");
 
+    toolBar->addSeparator();
+    QAction* zoomInAction = toolBar->addAction("Zoom In");
+    QAction* zoomOutAction = toolBar->addAction("Zoom Out");
+    QAction* lodAction = toolBar->addAction("Simplify When Zoomed Out");
+    lodAction->setCheckable(true);
+    lodAction->setChecked(Shape::isLevelOfDetailEnabled());
+    QAction* tileCacheAction = toolBar->addAction("Cache Static Shapes");
+    tileCacheAction->setCheckable(true);
+    tileCacheAction->setChecked(model->getScene()->isTileCacheEnabled());
+    QAction* batchAction = toolBar->addAction("Batch Rendering");
+    batchAction->setCheckable(true);
+    batchAction->setChecked(model->getScene()->isBatchedRendering());
+    QAction* recordAction = toolBar->addAction("Record Session");
+    recordAction->setCheckable(true);
+#ifdef SHAPE_EDITOR_PROFILING
+    // Замеры есть только в сборке с SHAPE_EDITOR_PROFILING
+    QAction* hudAction = toolBar->addAction("Show Performance HUD");
+    hudAction->setCheckable(true);
+    QAction* traceAction = toolBar->addAction("Export Trace");
+    connect(hudAction, &QAction::toggled, this, &MainWindow::onPerformanceHudToggled);
+    connect(traceAction, &QAction::triggered, this, &MainWindow::onExportTraceAction);
+#endif
+
     connect(selectAction, &QAction::triggered, this, &MainWindow::onSelectAction);
     connect(lineAction, &QAction::triggered, this, &MainWindow::onLineAction);
     connect(rectAction, &QAction::triggered, this, &MainWindow::onRectAction);
@@ -51,8 +106,22 @@ void MainWindow::setupToolBar() {
     connect(colorAction, &QAction::triggered, this, &MainWindow::onColorAction);
     connect(deleteAction, &QAction::triggered, this, &MainWindow::onDeleteAction);
     connect(clearAction, &QAction::triggered, this, &MainWindow::onClearAction);
+    connect(copyAction, &QAction::triggered, this, &MainWindow::onCopyAction);
+    connect(cutAction, &QAction::triggered, this, &MainWindow::onCutAction);
+    connect(pasteAction, &QAction::triggered, this, &MainWindow::onPasteAction);
+    connect(duplicateAction, &QAction::triggered, this, &MainWindow::onDuplicateAction);
+    connect(openAction, &QAction::triggered, this, &MainWindow::onOpenAction);
+    connect(saveAction, &QAction::triggered, this, &MainWindow::onSaveAction);
+    connect(exportAction, &QAction::triggered, this, &MainWindow::onExportAction);
+    connect(controller, &GraphicController::textRequested, this, &MainWindow::onTextRequested);
     connect(undoAction, &QAction::triggered, this, &MainWindow::onUndoAction);
     connect(redoAction, &QAction::triggered, this, &MainWindow::onRedoAction);
+    connect(zoomInAction, &QAction::triggered, this, &MainWindow::onZoomInAction);
+    connect(zoomOutAction, &QAction::triggered, this, &MainWindow::onZoomOutAction);
+    connect(lodAction, &QAction::toggled, this, &MainWindow::onLevelOfDetailToggled);
+    connect(tileCacheAction, &QAction::toggled, this, &MainWindow::onTileCacheToggled);
+    connect(batchAction, &QAction::toggled, this, &MainWindow::onBatchedRenderingToggled);
+    connect(recordAction, &QAction::toggled, this, &MainWindow::onRecordToggled);
 
     if (model && model->getUndoStack()) {
         connect(model->getUndoStack(), &QUndoStack::canUndoChanged,
@@ -76,11 +145,30 @@ void MainWindow::setupConnections() {
             this, &MainWindow::handleMouseMoved);
     connect(model->getScene(), &CustomGraphicsScene::sceneMouseReleased,
             this, &MainWindow::handleMouseReleased);
+    connect(jobs, &ModelJobs::loadFinished, this, &MainWindow::onLoadFinished);
+    connect(jobs, &ModelJobs::saveFinished, this, &MainWindow::onSaveFinished);
+}
+
+void MainWindow::setupAutosave() {
+    const QString directory = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+                              + "/autosave";
+
+    if (AutosaveJournal::hasRecoveryData(directory)) {
+        QMessageBox::StandardButton answer = QMessageBox::question(
+            this, "Recover Drawing",
+            "The editor was not closed properly. Restore the unsaved drawing?");
+        if (answer == QMessageBox::Yes) {
+            AutosaveJournal::recover(model, directory);
+        }
+    }
+
+    autosave = new AutosaveJournal(model, directory, this);
+    autosave->start();
 }
 
 void MainWindow::onSelectAction() {
     controller->setEditorMode(EditorMode::Select);
-    view->setDragMode(QGraphicsView::RubberBandDrag);
+    view->setDragMode(QGraphicsView::NoDrag);
 }
 
 void MainWindow::onLineAction() {
@@ -108,10 +196,23 @@ void MainWindow::onTextAction() {
     view->setDragMode(QGraphicsView::NoDrag);
 }
 
+void MainWindow::onTextRequested(const QPointF& pos) {
+    bool ok;
+    QString text = QInputDialog::getText(this, "Enter Text", "Text:",
+                                         QLineEdit::Normal, "", &ok);
+    if (ok) {
+        if (recorder)
+            recorder->recordText(pos, text);
+        controller->addText(pos, text);
+    }
+}
+
 void MainWindow::onColorAction() {
     QColor color = QColorDialog::getColor(controller->getCurrentColor(),
                                           this, "Select Color");
     if (color.isValid()) {
+        if (recorder)
+            recorder->recordColor(color);
         controller->setCurrentColor(color);
         controller->changeSelectedItemsColor(color);
     }
@@ -123,14 +224,17 @@ void MainWindow::onEditTextAction() {
         bool ok;
         QString newText = QInputDialog::getText(this, "Edit Text", "Text:",
                                                 QLineEdit::Normal, textShape->getText(), &ok);
-        if (ok && !newText.isEmpty()) {
-            textShape->setText(newText);
-        }
+        if (!ok || newText.isEmpty())
+            newText = textShape->getText();
 
-        QFontDialog fontDialog(textShape->getFont(), this);
-        if (fontDialog.exec() == QDialog::Accepted) {
-            textShape->setFont(fontDialog.selectedFont());
-        }
+        QFont newFont = textShape->getFont();
+        QFontDialog fontDialog(newFont, this);
+        if (fontDialog.exec() == QDialog::Accepted)
+            newFont = fontDialog.selectedFont();
+
+        if (recorder)
+            recorder->recordTextEdit(newText, newFont);
+        controller->editSelectedText(newText, newFont);
     }
 }
 
@@ -142,8 +246,152 @@ void MainWindow::onClearAction() {
     controller->clearAll();
 }
 
+void MainWindow::onCopyAction() {
+    controller->copySelection();
+}
+
+void MainWindow::onCutAction() {
+    controller->cutSelection();
+}
+
+void MainWindow::onPasteAction() {
+    controller->paste();
+}
+
+void MainWindow::onDuplicateAction() {
+    controller->duplicateSelection();
+}
+
+void MainWindow::onOpenAction() {
+    QString fileName = QFileDialog::getOpenFileName(this, "Open Drawing", QString(),
+                                                    "Shape documents (*.shapes)");
+    if (fileName.isEmpty())
+        return;
+
+    // Фигуры строятся в фоне, редактор остается отзывчивым
+    jobs->load(fileName);
+}
+
+void MainWindow::onLoadFinished(bool ok, const QString& errorString) {
+    if (!ok)
+        QMessageBox::warning(this, "Open Drawing", errorString);
+}
+
+void MainWindow::onSaveAction() {
+    QString fileName = QFileDialog::getSaveFileName(this, "Save Drawing", QString(),
+                                                    "Shape documents (*.shapes)");
+    if (fileName.isEmpty())
+        return;
+
+    jobs->save(fileName);
+}
+
+void MainWindow::onSaveFinished(bool ok, const QString& errorString) {
+    if (!ok)
+        QMessageBox::warning(this, "Save Drawing", errorString);
+}
+
+void MainWindow::onExportAction() {
+    QString fileName = QFileDialog::getSaveFileName(this, "Export Drawing", QString(),
+                                                    "PNG image (*.png);;SVG image (*.svg);;PDF document (*.pdf)");
+    if (fileName.isEmpty())
+        return;
+
+    // Снимок берется здесь, отрисовка и запись идут в фоне - редактор не замирает
+    const RenderList list = RenderList::snapshot(model->getShapes());
+
+    // Текст вне GUI-потока рисуется не на всех платформах - тогда экспорт синхронный
+    if (!QFontDatabase::supportsThreadedFontRendering()) {
+        QString error;
+        if (!ExportRenderer::exportToFile(list, fileName, ExportOptions(), &error))
+            QMessageBox::warning(this, "Export Drawing", error);
+        return;
+    }
+
+    QFutureWatcher<QString>* watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcher<QString>::finished, this, [this, watcher]() {
+        const QString error = watcher->result();
+        if (!error.isEmpty())
+            QMessageBox::warning(this, "Export Drawing", error);
+        watcher->deleteLater();
+    });
+    watcher->setFuture(QtConcurrent::run([list, fileName]() {
+        QString error;
+        ExportRenderer::exportToFile(list, fileName, ExportOptions(), &error);
+        return error;
+    }));
+}
+
+void MainWindow::onRecordToggled(bool enabled) {
+    if (enabled) {
+        delete recorder;
+        recorder = new SessionRecorder(model->getScene(), toolBar, this);
+        return;
+    }
+    if (!recorder)
+        return;
+
+    QString fileName = QFileDialog::getSaveFileName(this, "Save Session", QString(),
+                                                    "Editing sessions (*.session)");
+    QString error;
+    if (!fileName.isEmpty() && !recorder->save(fileName, &error)) {
+        QMessageBox::warning(this, "Save Session", error);
+    }
+    delete recorder;
+    recorder = nullptr;
+}
+
+void MainWindow::onPerformanceHudToggled(bool enabled) {
+    if (!performanceHud) {
+        performanceHud = new QLabel(view->viewport());
+        performanceHud->setAttribute(Qt::WA_TransparentForMouseEvents);
+        performanceHud->setStyleSheet("background: rgba(0, 0, 0, 160); color: white;"
+                                      "font-family: monospace; padding: 4px;");
+        performanceHud->move(8, 8);
+        performanceHudTimer = new QTimer(this);
+        performanceHudTimer->setInterval(250);
+        connect(performanceHudTimer, &QTimer::timeout, this, &MainWindow::updatePerformanceHud);
+    }
+
+    // Пока HUD скрыт, замеры выключены и почти ничего не стоят
+    if (enabled)
+        Profiler::reset();
+    Profiler::setEnabled(enabled);
+    performanceHud->setVisible(enabled);
+    if (enabled) {
+        updatePerformanceHud();
+        performanceHudTimer->start();
+    } else {
+        performanceHudTimer->stop();
+    }
+}
+
+void MainWindow::updatePerformanceHud() {
+    const Profiler::FrameStats stats = Profiler::frameStats();
+    performanceHud->setText(QString("FPS: %1\nFrame: %2 ms\nItems painted: %3\nInput to paint: %4 ms")
+                                .arg(stats.fps, 0, 'f', 0)
+                                .arg(stats.frameMs, 0, 'f', 2)
+                                .arg(stats.itemsPainted)
+                                .arg(stats.inputLatencyMs, 0, 'f', 2));
+    performanceHud->adjustSize();
+}
+
+void MainWindow::onExportTraceAction() {
+    QString fileName = QFileDialog::getSaveFileName(this, "Export Trace", QString(),
+                                                    "Chrome trace (*.json)");
+    if (fileName.isEmpty())
+        return;
+
+    QString error;
+    if (!Profiler::exportChromeTrace(fileName, &error)) {
+        QMessageBox::warning(this, "Export Trace", error);
+    }
+}
+
 void MainWindow::keyPressEvent(QKeyEvent* event) {
     if (event->key() == Qt::Key_Delete) {
+        if (recorder)
+            recorder->recordAction("Delete");
         controller->deleteSelectedItems();
     }
     QMainWindow::keyPressEvent(event);
@@ -162,18 +410,34 @@ void MainWindow::handleMouseReleased() {
 }
 
 void MainWindow::onUndoAction() {
-    model->getUndoStack()->undo();
+    model->undo();
 }
 
 void MainWindow::onRedoAction() {
     model->getUndoStack()->redo();
 }
 
+void MainWindow::onZoomInAction() {
+    view->scale(1.25, 1.25);
+}
+
+void MainWindow::onZoomOutAction() {
+    view->scale(0.8, 0.8);
+}
+
+void MainWindow::onLevelOfDetailToggled(bool enabled) {
+    Shape::setLevelOfDetailEnabled(enabled);
+    model->getScene()->invalidateAllTiles(); // Тайлы и пакеты построены с прежней детализацией
+}
+
+void MainWindow::onTileCacheToggled(bool enabled) {
+    model->getScene()->setTileCacheEnabled(enabled);
+}
+
+void MainWindow::onBatchedRenderingToggled(bool enabled) {
+    model->getScene()->setBatchedRendering(enabled);
+}
+
 Shape* MainWindow::getSelectedTextShape() {
-    for (Shape* shape : model->getShapes()) {
-        if (shape->isSelected() && shape->getType() == ShapeType::Text) {
-            return shape;
-        }
-    }
-    return nullptr;
+    return model->firstSelected(ShapeType::Text);
 }
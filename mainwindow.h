@@ -8,8 +8,14 @@
 #include <QFontDialog>
 #include <QInputDialog>
 #include <QKeyEvent>
+#include <QLabel>
+#include <QTimer>
 #include "graphicmodel.h"
 #include "graphiccontroller.h"
+#include "autosavejournal.h"
+
+class SessionRecorder;
+class ModelJobs;
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -26,10 +32,20 @@ private slots:
     void onRectAction();
     void onEllipseAction();
     void onTextAction();
+    void onTextRequested(const QPointF& pos);
     void onTriangleAction();
     void onColorAction();
     void onDeleteAction();
+    void onCopyAction();
+    void onCutAction();
+    void onPasteAction();
+    void onDuplicateAction();
     void onClearAction();
+    void onOpenAction();
+    void onSaveAction();
+    void onLoadFinished(bool ok, const QString& errorString);
+    void onSaveFinished(bool ok, const QString& errorString);
+    void onExportAction();
     void onEditTextAction(); // Новый слот для редактирования текста
 
     void handleMousePressed(const QPointF& pos);
@@ -37,11 +53,21 @@ private slots:
     void handleMouseReleased();
     void onUndoAction();
     void onRedoAction();
+    void onZoomInAction();
+    void onZoomOutAction();
+    void onLevelOfDetailToggled(bool enabled);
+    void onTileCacheToggled(bool enabled);
+    void onBatchedRenderingToggled(bool enabled);
+    void onRecordToggled(bool enabled);
+    void onPerformanceHudToggled(bool enabled);
+    void onExportTraceAction();
+    void updatePerformanceHud();
 
 private:
     void setupUI();
     void setupToolBar();
     void setupConnections();
+    void setupAutosave();
 
     QGraphicsView* view;
     QToolBar* toolBar;
@@ -49,6 +75,11 @@ private:
 
     GraphicModel* model;
     GraphicController* controller;
+    AutosaveJournal* autosave;
+    ModelJobs* jobs;
+    SessionRecorder* recorder;
+    QLabel* performanceHud;
+    QTimer* performanceHudTimer;
 
     Shape* getSelectedTextShape();
 };
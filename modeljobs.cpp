@@ -0,0 +1,260 @@
+#include "modeljobs.h"
+#include <QCoreApplication>
+#include <QFontDatabase>
+#include <QtConcurrent>
+#include "graphicmodel.h"
+#include "shapedocument.h"
+
+namespace {
+const int minChunkSize = 4096; // Меньшие куски не окупают постановку в пул
+}
+
+// Загрузка идет кусками; каждый кусок пишет только в свой элемент chunks.
+// Фигуры, не переданные модели (загрузка отменена), удаляются вместе с состоянием.
+struct ModelJobs::LoadState {
+    ~LoadState() {
+        for (const QVector<Shape*>& chunk : qAsConst(chunks)) {
+            qDeleteAll(chunk);
+        }
+    }
+
+    QSharedPointer<ShapeDocument> document;
+    QVector<QVector<Shape*>> chunks;
+    int pending = 0;
+    int done = 0;
+    int total = 0;
+    bool cancelled = false;
+};
+
+// Вставка тоже идет кусками: кусок пишет только свой элемент chunks и
+// chunkBounds. Для importData куски заполняют сами задания.
+struct ModelJobs::ImportState {
+    ~ImportState() {
+        for (const QVector<Shape*>& chunk : qAsConst(chunks)) {
+            qDeleteAll(chunk);
+        }
+    }
+
+    QSharedPointer<ShapeDocument> document; // Пустой - фигуры уже созданы
+    QVector<QVector<Shape*>> chunks;
+    QVector<QRectF> chunkBounds; // В координатах сцены
+    QPointF offset;
+    int chunkSize = 0;
+    int pending = 0;
+    int resetCount = 0;
+};
+
+ModelJobs::ModelJobs(GraphicModel* model, QObject* parent)
+    : QObject(parent), model(model), running(0), resetCount(0) {
+    connect(model, &GraphicModel::modelReset, this, [this]() { ++resetCount; });
+}
+
+ModelJobs::~ModelJobs() {
+    // Задания держат указатели на состояние загрузки и документ
+    pool.waitForDone();
+}
+
+void ModelJobs::setThreadCount(int count) {
+    pool.setMaxThreadCount(count > 0 ? count : QThread::idealThreadCount());
+}
+
+bool ModelJobs::isBusy() const {
+    return running > 0;
+}
+
+void ModelJobs::waitForDone() {
+    pool.waitForDone();
+    QCoreApplication::sendPostedEvents(); // Применить результаты сразу
+}
+
+template <typename T>
+void ModelJobs::watch(const QFuture<T>& future, std::function<void(const QFuture<T>&)> apply) {
+    ++running;
+    QFutureWatcher<T>* watcher = new QFutureWatcher<T>(this);
+    connect(watcher, &QFutureWatcher<T>::finished, this, [this, watcher, apply]() {
+        --running;
+        apply(watcher->future());
+        watcher->deleteLater();
+    });
+    watcher->setFuture(future);
+}
+
+int ModelJobs::chunkSizeFor(int total) const {
+    // Несколько кусков на поток, чтобы потоки заканчивали примерно вместе
+    const int threads = qMax(1, pool.maxThreadCount());
+    return qMax(minChunkSize, (total + threads * 4 - 1) / (threads * 4));
+}
+
+void ModelJobs::load(const QString& fileName) {
+    QSharedPointer<ShapeDocument> document(new ShapeDocument);
+    if (!document->open(fileName)) {
+        emit loadFinished(false, document->errorString());
+        return;
+    }
+
+    // Раскладка текста вне GUI-потока возможна не на всех платформах
+    if (!QFontDatabase::supportsThreadedFontRendering()) {
+        document.clear();
+        QString error;
+        const bool ok = model->load(fileName, &error);
+        emit loadFinished(ok, error);
+        return;
+    }
+
+    if (currentLoad)
+        currentLoad->cancelled = true;
+    QSharedPointer<LoadState> state(new LoadState);
+    currentLoad = state;
+    state->document = document;
+    state->total = document->shapeCount();
+    document->resolveFonts();
+
+    const int chunkSize = chunkSizeFor(state->total);
+    const int chunkCount = qMax(1, (state->total + chunkSize - 1) / chunkSize);
+    state->chunks.resize(chunkCount);
+    state->pending = chunkCount;
+
+    for (int i = 0; i < chunkCount; ++i) {
+        const int first = i * chunkSize;
+        const int last = qMin(state->total, first + chunkSize);
+        ShapeDocument* source = document.data();
+        QVector<Shape*>* out = &state->chunks[i];
+        watch<void>(QtConcurrent::run(&pool, [source, out, first, last]() {
+            out->reserve(last - first);
+            for (int index = first; index < last; ++index) {
+                Shape* shape = source->createShape(index);
+                if (shape)
+                    out->append(shape);
+            }
+        }), [this, state, first, last](const QFuture<void>&) {
+            state->done += last - first;
+            if (!state->cancelled)
+                emit loadProgress(state->done, state->total);
+            if (--state->pending == 0)
+                finishLoad(state);
+        });
+    }
+}
+
+void ModelJobs::finishLoad(const QSharedPointer<LoadState>& state) {
+    if (currentLoad == state)
+        currentLoad.clear();
+
+    if (state->cancelled)
+        return;
+
+    QList<Shape*> loaded;
+    loaded.reserve(state->total);
+    for (const QVector<Shape*>& chunk : qAsConst(state->chunks)) {
+        for (Shape* shape : chunk) {
+            loaded.append(shape);
+        }
+    }
+    state->chunks.clear();
+    state->document.clear();
+    model->resetShapes(loaded);
+    emit loadFinished(true, QString());
+}
+
+void ModelJobs::save(const QString& fileName) {
+    const ShapeDocument::Snapshot snapshot = ShapeDocument::snapshot(model->getShapes());
+    watch<QString>(QtConcurrent::run(&pool, [fileName, snapshot]() {
+        QString error;
+        ShapeDocument::save(fileName, snapshot, &error);
+        return error;
+    }), [this](const QFuture<QString>& future) {
+        const QString error = future.result();
+        emit saveFinished(error.isEmpty(), error);
+    });
+}
+
+void ModelJobs::importShapes(const QList<Shape*>& shapes, const QPointF& offset) {
+    QSharedPointer<ImportState> state(new ImportState);
+    state->offset = offset;
+    state->chunkSize = chunkSizeFor(shapes.size());
+    for (int first = 0; first < shapes.size(); first += state->chunkSize) {
+        state->chunks.append(shapes.mid(first, state->chunkSize).toVector());
+    }
+    startImport(state);
+}
+
+void ModelJobs::importData(const QByteArray& bytes, const QPointF& offset) {
+    QSharedPointer<ShapeDocument> document(new ShapeDocument);
+    if (!document->openData(bytes)) {
+        qWarning("ModelJobs: clipboard: %s", qPrintable(document->errorString()));
+        return;
+    }
+
+    // Раскладка текста вне GUI-потока возможна не на всех платформах:
+    // тогда фигуры создаются здесь, а сдвиг и контуры остаются пулу
+    if (!QFontDatabase::supportsThreadedFontRendering()) {
+        QList<Shape*> shapes;
+        shapes.reserve(document->shapeCount());
+        for (int i = 0; i < document->shapeCount(); ++i) {
+            Shape* shape = document->createShape(i);
+            if (shape)
+                shapes.append(shape);
+        }
+        importShapes(shapes, offset);
+        return;
+    }
+
+    QSharedPointer<ImportState> state(new ImportState);
+    state->document = document;
+    state->offset = offset;
+    state->chunkSize = chunkSizeFor(document->shapeCount());
+    state->chunks.resize((document->shapeCount() + state->chunkSize - 1) / state->chunkSize);
+    document->resolveFonts();
+    startImport(state);
+}
+
+void ModelJobs::startImport(const QSharedPointer<ImportState>& state) {
+    state->resetCount = resetCount;
+    state->chunkBounds.resize(state->chunks.size());
+    state->pending = state->chunks.size();
+
+    for (int i = 0; i < state->chunks.size(); ++i) {
+        ShapeDocument* source = state->document.data();
+        const int first = i * state->chunkSize;
+        const int last = source ? qMin(source->shapeCount(), first + state->chunkSize) : first;
+        const QPointF offset = state->offset;
+        QVector<Shape*>* shapes = &state->chunks[i];
+        QRectF* bounds = &state->chunkBounds[i];
+        // Фигуры еще не на сцене и не в модели - их трогает только это задание
+        watch<void>(QtConcurrent::run(&pool, [source, first, last, offset, shapes, bounds]() {
+            shapes->reserve(shapes->size() + last - first);
+            for (int index = first; index < last; ++index) {
+                Shape* shape = source->createShape(index);
+                if (shape)
+                    shapes->append(shape);
+            }
+            for (Shape* shape : qAsConst(*shapes)) {
+                shape->moveBy(offset.x(), offset.y());
+                shape->prepareHitPath();
+                *bounds |= shape->boundingRect().translated(shape->pos());
+            }
+        }), [this, state](const QFuture<void>&) {
+            if (--state->pending == 0)
+                finishImport(state);
+        });
+    }
+}
+
+void ModelJobs::finishImport(const QSharedPointer<ImportState>& state) {
+    // Документ заменен, пока фигуры готовились; они удаляются вместе с состоянием
+    if (state->resetCount != resetCount)
+        return;
+
+    QList<Shape*> shapes;
+    QRectF bounds;
+    for (int i = 0; i < state->chunks.size(); ++i) {
+        for (Shape* shape : state->chunks.at(i)) {
+            shapes.append(shape);
+        }
+        bounds |= state->chunkBounds.at(i);
+    }
+    state->chunks.clear();
+    state->document.clear();
+    model->importShapes(shapes, bounds);
+    emit importFinished(shapes);
+}
@@ -0,0 +1,69 @@
+#ifndef MODELJOBS_H
+#define MODELJOBS_H
+
+#include <QObject>
+#include <QList>
+#include <QPointF>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QFutureWatcher>
+#include <functional>
+
+class GraphicModel;
+class Shape;
+
+// Тяжелая работа над документом в пуле потоков. Задание получает снимок -
+// отображенный файл, ShapeDocument::Snapshot или фигуры, которых еще нет
+// в модели, - а результат применяется
+// к модели в GUI-потоке одним пакетом. Пока задание идет, GUI-поток
+// обрабатывает ввод. Новая загрузка отменяет результат предыдущей.
+class ModelJobs : public QObject {
+    Q_OBJECT
+public:
+    explicit ModelJobs(GraphicModel* model, QObject* parent = nullptr);
+    ~ModelJobs() override;
+
+    void setThreadCount(int count); // 0 - по числу ядер
+    bool isBusy() const;
+    void waitForDone();
+
+    // Фигуры вместе с раскладкой текста строятся в пуле кусками,
+    // затем документ модели заменяется одним пакетом (resetShapes)
+    void load(const QString& fileName);
+    // В GUI-потоке снимаются только значения фигур (как у автосохранения),
+    // сериализация и запись на диск - в пуле
+    void save(const QString& fileName);
+
+    // Вставка фигур, еще не принадлежащих модели: клонов (importShapes) или
+    // записей буфера обмена (importData). В пуле фигуры создаются, сдвигаются
+    // на offset и получают контур попадания; там же считаются их общие
+    // границы. В модель они попадают одной командой AddShapesCommand.
+    // Если документ заменен раньше (load, clear), вставка отменяется.
+    void importShapes(const QList<Shape*>& shapes, const QPointF& offset);
+    void importData(const QByteArray& bytes, const QPointF& offset);
+
+signals:
+    void loadProgress(int done, int total);
+    void loadFinished(bool ok, const QString& errorString);
+    void saveFinished(bool ok, const QString& errorString);
+    void importFinished(const QList<Shape*>& shapes); // Фигуры уже в модели
+
+private:
+    struct LoadState;
+    struct ImportState;
+
+    template <typename T>
+    void watch(const QFuture<T>& future, std::function<void(const QFuture<T>&)> apply);
+    int chunkSizeFor(int total) const;
+    void finishLoad(const QSharedPointer<LoadState>& state);
+    void startImport(const QSharedPointer<ImportState>& state);
+    void finishImport(const QSharedPointer<ImportState>& state);
+
+    GraphicModel* model;
+    QThreadPool pool;
+    QSharedPointer<LoadState> currentLoad;
+    int running;
+    int resetCount; // Сколько раз документ модели заменялся (modelReset)
+};
+
+#endif // MODELJOBS_H
@@ -0,0 +1,171 @@
+#include "profiler.h"
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QVector>
+
+std::atomic<bool> Profiler::enabledFlag(false);
+std::atomic<quint64> Profiler::counters[Profiler::CounterCount];
+
+namespace {
+const int maxEventsPerThread = 1000000;
+
+struct TraceEvent {
+    const char* name;
+    qint64 start;
+    qint64 duration;
+};
+
+// Свой буфер у каждого потока; мьютекс нужен только на время экспорта
+struct ThreadBuffer {
+    int threadId;
+    QMutex mutex;
+    QVector<TraceEvent> events;
+};
+
+struct Registry {
+    QMutex mutex;
+    QList<ThreadBuffer*> buffers;
+    QElapsedTimer clock;
+    Registry() { clock.start(); }
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+ThreadBuffer* threadBuffer() {
+    // Буферы живут до конца процесса, чтобы экспорт видел и завершенные потоки
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (!buffer) {
+        Registry& r = registry();
+        QMutexLocker locker(&r.mutex);
+        buffer = new ThreadBuffer;
+        buffer->threadId = r.buffers.size() + 1;
+        r.buffers.append(buffer);
+    }
+    return buffer;
+}
+
+struct FrameState {
+    qint64 frameStart = -1;
+    qint64 inputTime = -1;
+    quint64 paintedAtStart = 0;
+    QVector<qint64> recentFrames; // Концы кадров за последнюю секунду
+    Profiler::FrameStats stats;
+};
+
+FrameState& frameState() {
+    static FrameState state;
+    return state;
+}
+}
+
+void Profiler::setEnabled(bool enabled) {
+    enabledFlag.store(enabled, std::memory_order_relaxed);
+}
+
+void Profiler::reset() {
+    Registry& r = registry();
+    QMutexLocker locker(&r.mutex);
+    for (ThreadBuffer* buffer : r.buffers) {
+        QMutexLocker bufferLocker(&buffer->mutex);
+        buffer->events.clear();
+    }
+    for (std::atomic<quint64>& counter : counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    frameState() = FrameState();
+}
+
+qint64 Profiler::now() {
+    return registry().clock.nsecsElapsed();
+}
+
+void Profiler::record(const char* name, qint64 start, qint64 end) {
+    ThreadBuffer* buffer = threadBuffer();
+    QMutexLocker locker(&buffer->mutex);
+    if (buffer->events.size() < maxEventsPerThread)
+        buffer->events.append({ name, start, end - start });
+}
+
+void Profiler::beginFrame() {
+    FrameState& state = frameState();
+    state.frameStart = now();
+    state.paintedAtStart = counters[ShapesPainted].load(std::memory_order_relaxed);
+}
+
+void Profiler::endFrame() {
+    FrameState& state = frameState();
+    if (state.frameStart < 0)
+        return;
+
+    const qint64 end = now();
+    record("frame", state.frameStart, end);
+
+    FrameStats& stats = state.stats;
+    stats.frameMs = (end - state.frameStart) / 1e6;
+    stats.itemsPainted = int(counters[ShapesPainted].load(std::memory_order_relaxed)
+                             - state.paintedAtStart);
+    ++stats.frames;
+    if (state.inputTime >= 0) {
+        stats.inputLatencyMs = (end - state.inputTime) / 1e6;
+        state.inputTime = -1;
+    }
+
+    state.recentFrames.append(end);
+    int expired = 0;
+    while (expired < state.recentFrames.size() && end - state.recentFrames.at(expired) > 1000000000)
+        ++expired;
+    state.recentFrames.remove(0, expired);
+    stats.fps = state.recentFrames.size();
+    state.frameStart = -1;
+}
+
+void Profiler::markInput() {
+    // Задержка считается от первого события, которое еще не отрисовано
+    FrameState& state = frameState();
+    if (state.inputTime < 0)
+        state.inputTime = now();
+}
+
+Profiler::FrameStats Profiler::frameStats() {
+    return frameState().stats;
+}
+
+bool Profiler::exportChromeTrace(const QString& fileName, QString* errorString) {
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+
+    QTextStream stream(&file);
+    stream << "{\"traceEvents\":[";
+    bool first = true;
+    Registry& r = registry();
+    QMutexLocker locker(&r.mutex);
+    for (ThreadBuffer* buffer : r.buffers) {
+        QMutexLocker bufferLocker(&buffer->mutex);
+        for (const TraceEvent& event : buffer->events) {
+            stream << (first ? "" : ",") << "\n{\"name\":\"" << event.name
+                   << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId
+                   << ",\"ts\":" << QString::number(event.start / 1000.0, 'f', 3)
+                   << ",\"dur\":" << QString::number(event.duration / 1000.0, 'f', 3) << "}";
+            first = false;
+        }
+    }
+    stream << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    stream.flush();
+
+    if (!file.commit()) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QString>
+#include <atomic>
+
+// Легкие замеры горячих путей. Макросы PROFILE_* раскрываются в код только
+// при сборке с SHAPE_EDITOR_PROFILING; без него их нет вовсе. Со сборкой,
+// но выключенным Profiler, замер стоит одной атомарной загрузки.
+class Profiler {
+public:
+    enum Counter { ShapesPainted, BoundingRectCalls, CounterCount };
+
+    struct FrameStats {
+        qreal fps = 0;
+        qreal frameMs = 0;        // Длительность последней отрисовки
+        int itemsPainted = 0;     // Фигур за последний кадр
+        qreal inputLatencyMs = 0; // От последнего события мыши до конца кадра
+        quint64 frames = 0;
+    };
+
+    static void setEnabled(bool enabled);
+    static bool isEnabled() { return enabledFlag.load(std::memory_order_relaxed); }
+    static void reset();
+
+    static qint64 now(); // нс от запуска процесса
+    static void record(const char* name, qint64 start, qint64 end);
+    static void count(Counter counter) {
+        counters[counter].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Кадр и ввод отмечаются только из GUI-потока
+    static void beginFrame();
+    static void endFrame();
+    static void markInput();
+    static FrameStats frameStats();
+
+    // Формат Trace Event (chrome://tracing, Perfetto)
+    static bool exportChromeTrace(const QString& fileName, QString* errorString = nullptr);
+
+private:
+    static std::atomic<bool> enabledFlag;
+    static std::atomic<quint64> counters[CounterCount];
+};
+
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name)
+        : name(name), start(Profiler::isEnabled() ? Profiler::now() : -1) {}
+    ~ProfileScope() {
+        if (start >= 0)
+            Profiler::record(name, start, Profiler::now());
+    }
+
+private:
+    const char* name;
+    qint64 start;
+};
+
+#ifdef SHAPE_EDITOR_PROFILING
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_COUNT(counter) \
+    do { if (Profiler::isEnabled()) Profiler::count(Profiler::counter); } while (0)
+#define PROFILE_FRAME_BEGIN() \
+    do { if (Profiler::isEnabled()) Profiler::beginFrame(); } while (0)
+#define PROFILE_FRAME_END() \
+    do { if (Profiler::isEnabled()) Profiler::endFrame(); } while (0)
+#define PROFILE_INPUT() \
+    do { if (Profiler::isEnabled()) Profiler::markInput(); } while (0)
+#else
+#define PROFILE_SCOPE(name) do {} while (0)
+#define PROFILE_COUNT(counter) do {} while (0)
+#define PROFILE_FRAME_BEGIN() do {} while (0)
+#define PROFILE_FRAME_END() do {} while (0)
+#define PROFILE_INPUT() do {} while (0)
+#endif
+
+#endif // PROFILER_H
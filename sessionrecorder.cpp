@@ -0,0 +1,392 @@
+#include "sessionrecorder.h"
+#include <QAction>
+#include <QCoreApplication>
+#include <QFile>
+#include <QGraphicsSceneMouseEvent>
+#include <QImage>
+#include <QPainter>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QToolBar>
+#include <QUrl>
+#include <algorithm>
+#include "graphiccontroller.h"
+#include "graphicmodel.h"
+
+namespace {
+const char* const typeNames[] = { "press", "move", "release", "action", "color", "text",
+                                   "edit-text" };
+const int typeCount = sizeof(typeNames) / sizeof(typeNames[0]);
+
+int typeFromName(const QString& name) {
+    for (int i = 0; i < typeCount; ++i) {
+        if (name == QLatin1String(typeNames[i]))
+            return i;
+    }
+    return -1;
+}
+
+qint64 percentile(const QVector<qint64>& sorted, qreal fraction) {
+    if (sorted.isEmpty())
+        return 0;
+    const int index = qMin(sorted.size() - 1, int(fraction * sorted.size()));
+    return sorted.at(index);
+}
+}
+
+SessionRecorder::SessionRecorder(CustomGraphicsScene* scene, QToolBar* toolBar, QObject* parent)
+    : QObject(parent) {
+    clock.start();
+    scene->installEventFilter(this);
+    if (toolBar)
+        connect(toolBar, &QToolBar::actionTriggered, this, &SessionRecorder::onActionTriggered);
+}
+
+void SessionRecorder::recordAction(const QString& name) {
+    SessionEvent event;
+    event.type = SessionEvent::Action;
+    event.argument = name;
+    append(event);
+}
+
+void SessionRecorder::recordColor(const QColor& color) {
+    SessionEvent event;
+    event.type = SessionEvent::Color;
+    event.argument = color.name(QColor::HexArgb);
+    append(event);
+}
+
+void SessionRecorder::recordText(const QPointF& pos, const QString& text) {
+    SessionEvent event;
+    event.type = SessionEvent::Text;
+    event.pos = pos;
+    event.argument = text;
+    append(event);
+}
+
+void SessionRecorder::recordTextEdit(const QString& text, const QFont& font) {
+    // Шрифт без пробелов идет первым, текст - до конца строки
+    SessionEvent event;
+    event.type = SessionEvent::EditText;
+    event.argument = QString::fromLatin1(QUrl::toPercentEncoding(font.toString()))
+                     + QLatin1Char(' ') + text;
+    append(event);
+}
+
+const QVector<SessionEvent>& SessionRecorder::events() const {
+    return recorded;
+}
+
+bool SessionRecorder::eventFilter(QObject* watched, QEvent* event) {
+    SessionEvent::Type type;
+    switch (event->type()) {
+    case QEvent::GraphicsSceneMousePress:   type = SessionEvent::Press; break;
+    case QEvent::GraphicsSceneMouseMove:    type = SessionEvent::Move; break;
+    case QEvent::GraphicsSceneMouseRelease: type = SessionEvent::Release; break;
+    default:
+        return QObject::eventFilter(watched, event);
+    }
+
+    const QGraphicsSceneMouseEvent* mouseEvent = static_cast<QGraphicsSceneMouseEvent*>(event);
+    // Движения без нажатой кнопки (наведение) не меняют документ
+    if (type == SessionEvent::Move && mouseEvent->buttons() == Qt::NoButton)
+        return false;
+
+    SessionEvent recordedEvent;
+    recordedEvent.type = type;
+    recordedEvent.pos = mouseEvent->scenePos();
+    recordedEvent.button = mouseEvent->button();
+    recordedEvent.buttons = mouseEvent->buttons();
+    recordedEvent.modifiers = mouseEvent->modifiers();
+    append(recordedEvent);
+    return false;
+}
+
+void SessionRecorder::onActionTriggered(QAction* action) {
+    recordAction(action->text());
+}
+
+void SessionRecorder::append(SessionEvent event) {
+    event.time = clock.elapsed();
+    recorded.append(event);
+}
+
+bool SessionRecorder::save(const QString& fileName, QString* errorString) const {
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+
+    // Строка на событие: время, тип, x, y, кнопка, кнопки, модификаторы, аргумент
+    QTextStream stream(&file);
+    for (const SessionEvent& event : recorded) {
+        stream << event.time << ' ' << typeNames[event.type] << ' '
+               << event.pos.x() << ' ' << event.pos.y() << ' '
+               << event.button << ' ' << event.buttons << ' ' << event.modifiers;
+        if (!event.argument.isEmpty())
+            stream << ' ' << event.argument;
+        stream << '\n';
+    }
+    stream.flush();
+
+    if (!file.commit()) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool SessionRecorder::load(const QString& fileName, QVector<SessionEvent>& events,
+                           QString* errorString) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+
+    events.clear();
+    QTextStream stream(&file);
+    for (int line = 1; !stream.atEnd(); ++line) {
+        const QString text = stream.readLine();
+        if (text.trimmed().isEmpty())
+            continue;
+
+        const QStringList fields = text.split(QLatin1Char(' '));
+        const int type = typeFromName(fields.value(1));
+        if (fields.size() < 7 || type < 0) {
+            if (errorString)
+                *errorString = QStringLiteral("Malformed event at line %1").arg(line);
+            return false;
+        }
+
+        SessionEvent event;
+        event.time = fields.at(0).toLongLong();
+        event.type = static_cast<SessionEvent::Type>(type);
+        event.pos = QPointF(fields.at(2).toDouble(), fields.at(3).toDouble());
+        event.button = fields.at(4).toInt();
+        event.buttons = fields.at(5).toInt();
+        event.modifiers = fields.at(6).toInt();
+        event.argument = fields.mid(7).join(QLatin1Char(' '));
+        events.append(event);
+    }
+    return true;
+}
+
+SessionReplayer::SessionReplayer(GraphicModel* model, GraphicController* controller)
+    : model(model), controller(controller), coalesceMoves(false), latencies(typeCount) {}
+
+void SessionReplayer::setCoalesceMoves(bool coalesce) {
+    coalesceMoves = coalesce;
+}
+
+void SessionReplayer::setRenderSize(const QSize& size) {
+    renderSize = size;
+}
+
+void SessionReplayer::replay(const QVector<SessionEvent>& events) {
+    CustomGraphicsScene* scene = model->getScene();
+
+    // То же подключение, что делает MainWindow; текст из диалога приходит
+    // отдельным событием Text, поэтому textRequested не обрабатываем
+    QObject context;
+    QObject::connect(scene, &CustomGraphicsScene::sceneMousePressed, &context,
+                     [this](const QPointF& pos) { controller->mousePressed(pos); });
+    QObject::connect(scene, &CustomGraphicsScene::sceneMouseMoved, &context,
+                     [this](const QPointF& pos) { controller->mouseMoved(pos); });
+    QObject::connect(scene, &CustomGraphicsScene::sceneMouseReleased, &context,
+                     [this]() { controller->mouseReleased(); });
+
+    QImage image;
+    if (renderSize.isValid())
+        image = QImage(renderSize, QImage::Format_ARGB32_Premultiplied);
+
+    QElapsedTimer timer;
+    for (const SessionEvent& event : events) {
+        timer.start();
+        dispatch(event);
+        if (!image.isNull()) {
+            QPainter painter(&image);
+            scene->render(&painter, QRectF(QPointF(), renderSize), scene->sceneRect());
+        }
+        latencies[event.type].append(timer.nsecsElapsed());
+    }
+    scene->frameThrottle()->flush();
+}
+
+void SessionReplayer::dispatch(const SessionEvent& event) {
+    CustomGraphicsScene* scene = model->getScene();
+
+    switch (event.type) {
+    case SessionEvent::Press:
+    case SessionEvent::Move:
+    case SessionEvent::Release: {
+        static const QEvent::Type eventTypes[] = { QEvent::GraphicsSceneMousePress,
+                                                   QEvent::GraphicsSceneMouseMove,
+                                                   QEvent::GraphicsSceneMouseRelease };
+        if (event.type == SessionEvent::Press) {
+            pressPos = event.pos;
+            lastPos = event.pos;
+        }
+
+        QGraphicsSceneMouseEvent mouseEvent(eventTypes[event.type]);
+        mouseEvent.setScenePos(event.pos);
+        mouseEvent.setScreenPos(event.pos.toPoint());
+        mouseEvent.setLastScenePos(lastPos);
+        mouseEvent.setLastScreenPos(lastPos.toPoint());
+        mouseEvent.setButtonDownScenePos(Qt::LeftButton, pressPos);
+        mouseEvent.setButtonDownScreenPos(Qt::LeftButton, pressPos.toPoint());
+        mouseEvent.setButton(static_cast<Qt::MouseButton>(event.button));
+        mouseEvent.setButtons(static_cast<Qt::MouseButtons>(event.buttons));
+        mouseEvent.setModifiers(static_cast<Qt::KeyboardModifiers>(event.modifiers));
+        mouseEvent.setAccepted(false);
+        QCoreApplication::sendEvent(scene, &mouseEvent);
+        lastPos = event.pos;
+
+        // Без цикла событий таймер кадра не сработает: либо применяем сразу,
+        // либо копим до отпускания, как при очень быстрой мыши
+        if (event.type == SessionEvent::Move && !coalesceMoves)
+            scene->frameThrottle()->flush();
+        break;
+    }
+    case SessionEvent::Action: {
+        const QString& name = event.argument;
+        if (name == QLatin1String("Select")) {
+            controller->setEditorMode(EditorMode::Select);
+        } else if (name == QLatin1String("Line")) {
+            controller->setEditorMode(EditorMode::CreateLine);
+        } else if (name == QLatin1String("Rectangle")) {
+            controller->setEditorMode(EditorMode::CreateRect);
+        } else if (name == QLatin1String("Ellipse")) {
+            controller->setEditorMode(EditorMode::CreateEllipse);
+        } else if (name == QLatin1String("Triangle")) {
+            controller->setEditorMode(EditorMode::CreateTriangle);
+        } else if (name == QLatin1String("Text")) {
+            controller->setEditorMode(EditorMode::CreateText);
+        } else if (name == QLatin1String("Delete")) {
+            controller->deleteSelectedItems();
+        } else if (name == QLatin1String("Clear")) {
+            controller->clearAll();
+        } else if (name == QLatin1String("Copy")) {
+            controller->copySelection();
+        } else if (name == QLatin1String("Cut")) {
+            controller->cutSelection();
+        } else if (name == QLatin1String("Paste")) {
+            controller->paste();
+        } else if (name == QLatin1String("Duplicate")) {
+            controller->duplicateSelection();
+        } else if (name == QLatin1String("Undo")) {
+            model->undo();
+        } else if (name == QLatin1String("Redo")) {
+            model->getUndoStack()->redo();
+        }
+        // Остальное (масштаб, файлы, настройки отрисовки) документ не меняет
+        break;
+    }
+    case SessionEvent::Color: {
+        const QColor color(event.argument);
+        controller->setCurrentColor(color);
+        controller->changeSelectedItemsColor(color);
+        break;
+    }
+    case SessionEvent::Text:
+        controller->addText(event.pos, event.argument);
+        break;
+    case SessionEvent::EditText: {
+        const QString fontName = event.argument.section(QLatin1Char(' '), 0, 0);
+        QFont font;
+        font.fromString(QUrl::fromPercentEncoding(fontName.toLatin1()));
+        controller->editSelectedText(event.argument.section(QLatin1Char(' '), 1), font);
+        break;
+    }
+    }
+}
+
+QString SessionReplayer::report() const {
+    QString result;
+    QTextStream stream(&result);
+    stream << "event      count     p50 us     p95 us     p99 us     max us\n";
+    for (int type = 0; type < typeCount; ++type) {
+        QVector<qint64> sorted = latencies.at(type);
+        if (sorted.isEmpty())
+            continue;
+        std::sort(sorted.begin(), sorted.end());
+        stream << QString("%1 %2 %3 %4 %5 %6\n")
+                      .arg(QLatin1String(typeNames[type]), -8)
+                      .arg(sorted.size(), 8)
+                      .arg(percentile(sorted, 0.50) / 1000.0, 10, 'f', 1)
+                      .arg(percentile(sorted, 0.95) / 1000.0, 10, 'f', 1)
+                      .arg(percentile(sorted, 0.99) / 1000.0, 10, 'f', 1)
+                      .arg(sorted.last() / 1000.0, 10, 'f', 1);
+    }
+    return result;
+}
+
+int SessionReplayer::runCommandLine(const QStringList& arguments) {
+    const int index = arguments.indexOf(QStringLiteral("--replay"));
+    if (index < 0 || index + 1 >= arguments.size()) {
+        qWarning("Usage: --replay <session> [--document file.shapes] [--render WxH] [--coalesce]"
+                 " [--batched | --compare-batching]");
+        return 2;
+    }
+
+    QVector<SessionEvent> events;
+    QString error;
+    if (!SessionRecorder::load(arguments.at(index + 1), events, &error)) {
+        qWarning("%s", qPrintable(error));
+        return 1;
+    }
+
+    const int documentIndex = arguments.indexOf(QStringLiteral("--document"));
+    const QString document = documentIndex >= 0 && documentIndex + 1 < arguments.size()
+                                 ? arguments.at(documentIndex + 1) : QString();
+    QSize renderSize;
+    const int renderIndex = arguments.indexOf(QStringLiteral("--render"));
+    if (renderIndex >= 0 && renderIndex + 1 < arguments.size()) {
+        const QStringList size = arguments.at(renderIndex + 1).split(QLatin1Char('x'));
+        renderSize = QSize(size.value(0).toInt(), size.value(1).toInt());
+    }
+    const bool coalesce = arguments.contains(QStringLiteral("--coalesce"));
+
+    // Каждый прогон - с чистой моделью и тем же документом
+    auto replayOnce = [&](bool batched, QString* report) {
+        GraphicModel model;
+        GraphicController controller(&model);
+        SessionReplayer replayer(&model, &controller);
+        if (!document.isEmpty() && !model.load(document, &error))
+            return false;
+        replayer.setRenderSize(renderSize);
+        replayer.setCoalesceMoves(coalesce);
+        model.getScene()->setBatchedRendering(batched);
+        replayer.replay(events);
+        *report = replayer.report();
+        return true;
+    };
+
+    QTextStream out(stdout);
+    QString report;
+    if (arguments.contains(QStringLiteral("--compare-batching"))) {
+        // Одна сессия без пакетов и с ними; имеет смысл вместе с --render
+        if (!replayOnce(false, &report)) {
+            qWarning("%s", qPrintable(error));
+            return 1;
+        }
+        out << "without batching\n" << report;
+        if (!replayOnce(true, &report)) {
+            qWarning("%s", qPrintable(error));
+            return 1;
+        }
+        out << "\nwith batching\n" << report;
+        return 0;
+    }
+
+    if (!replayOnce(arguments.contains(QStringLiteral("--batched")), &report)) {
+        qWarning("%s", qPrintable(error));
+        return 1;
+    }
+    out << report;
+    return 0;
+}
@@ -0,0 +1,94 @@
+#ifndef SESSIONRECORDER_H
+#define SESSIONRECORDER_H
+
+#include <QColor>
+#include <QFont>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QPointF>
+#include <QSize>
+#include <QStringList>
+#include <QVector>
+
+class CustomGraphicsScene;
+class GraphicController;
+class GraphicModel;
+class QAction;
+class QToolBar;
+
+// Одно событие записанного сеанса
+struct SessionEvent {
+    enum Type { Press, Move, Release, Action, Color, Text, EditText };
+
+    qint64 time = 0; // мс от начала записи
+    Type type = Move;
+    QPointF pos;
+    int button = 0;
+    int buttons = 0;
+    int modifiers = 0;
+    QString argument; // Имя действия, цвет, текст или шрифт с текстом
+};
+
+// Записывает сеанс правки: мышь на уровне событий сцены (их получают и
+// фигуры, и контроллер через sceneMouse*), действия панели инструментов
+// и значения из диалогов, которых при воспроизведении не будет.
+class SessionRecorder : public QObject {
+    Q_OBJECT
+public:
+    SessionRecorder(CustomGraphicsScene* scene, QToolBar* toolBar, QObject* parent = nullptr);
+
+    void recordAction(const QString& name); // Для действий не с панели (клавиши)
+    void recordColor(const QColor& color);
+    void recordText(const QPointF& pos, const QString& text);
+    void recordTextEdit(const QString& text, const QFont& font); // Окно "Edit Text"
+
+    const QVector<SessionEvent>& events() const;
+    bool save(const QString& fileName, QString* errorString = nullptr) const;
+    static bool load(const QString& fileName, QVector<SessionEvent>& events,
+                     QString* errorString = nullptr);
+
+protected:
+    bool eventFilter(QObject* watched, QEvent* event) override;
+
+private:
+    void onActionTriggered(QAction* action);
+    void append(SessionEvent event);
+
+    QElapsedTimer clock;
+    QVector<SessionEvent> recorded;
+};
+
+// Детерминированно воспроизводит сеанс без окна: события мыши посылаются
+// в сцену синхронно, действия вызывают контроллер напрямую.
+// Замеряет время обработки каждого события.
+class SessionReplayer {
+public:
+    SessionReplayer(GraphicModel* model, GraphicController* controller);
+
+    // По умолчанию каждое движение применяется сразу (худший случай);
+    // с coalesce движения прореживаются FrameThrottle, как в редакторе
+    void setCoalesceMoves(bool coalesce);
+    // Непустой размер - после каждого события сцена рисуется в QImage
+    void setRenderSize(const QSize& size);
+
+    void replay(const QVector<SessionEvent>& events);
+    QString report() const; // Перцентили задержки по типам событий
+
+    //   --replay <session> [--document file.shapes] [--render WxH] [--coalesce]
+    //            [--batched | --compare-batching]
+    // --compare-batching проигрывает сеанс дважды, без пакетной отрисовки и с ней
+    static int runCommandLine(const QStringList& arguments);
+
+private:
+    void dispatch(const SessionEvent& event);
+
+    GraphicModel* model;
+    GraphicController* controller;
+    bool coalesceMoves;
+    QSize renderSize;
+    QPointF lastPos;
+    QPointF pressPos;
+    QVector<QVector<qint64>> latencies; // нс, по SessionEvent::Type
+};
+
+#endif // SESSIONRECORDER_H
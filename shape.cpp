@@ -1,36 +1,144 @@
 #include "shape.h"
 #include <QCursor>
 #include <QGraphicsSceneMouseEvent>
+#include <QStyleOptionGraphicsItem>
+#include "customgraphicsscene.h"
+#include "graphicmodel.h"
+#include "profiler.h"
+#include "shapepool.h"
+
+namespace {
+bool levelOfDetailEnabled = false;
+qreal antialiasingScale = 0.5;
+const qreal handlesScale = 0.5;   // Ниже этого масштаба маркеры не рисуются
+const qreal hiddenItemSize = 1.0; // Фигуры меньше пикселя пропускаются
+const qreal tinyItemSize = 4.0;   // Мелкие фигуры рисуются заливкой прямоугольника
+const qreal handleSize = 8;
+
+// Перетаскивание маркера: одновременно изменяется только одна фигура,
+// поэтому состояние не хранится в каждой Shape
+struct ResizeState {
+    Shape* shape = nullptr;
+    int handle = 0;
+    QPointF startPos;     // Геометрия до начала перетаскивания
+    QPointF endPos;
+    QPointF pressPos;     // Точка нажатия в координатах сцены
+    QPointF targetStart;  // Последняя запрошенная геометрия, применяется раз в кадр
+    QPointF targetEnd;
+};
+ResizeState resizeState;
+
+void applyPendingResize() {
+    if (resizeState.shape)
+        resizeState.shape->setGeometry(resizeState.targetStart, resizeState.targetEnd);
+}
+
+FrameThrottle* frameThrottleOf(const QGraphicsItem* item) {
+    CustomGraphicsScene* customScene = qobject_cast<CustomGraphicsScene*>(item->scene());
+    return customScene ? customScene->frameThrottle() : nullptr;
+}
+}
 
 Shape::Shape(ShapeType type, const QPointF& startPos, const QColor& color, QGraphicsItem* parent)
     : QGraphicsItem(parent), type(type), startPos(startPos), endPos(startPos),
-    color(color), isEditing(false), currentHandle(None), isResizing(false) {
-    font = QFont("Arial", 12); // Устанавливаем шрифт по умолчанию
-    setFlags(QGraphicsItem::ItemIsSelectable | QGraphicsItem::ItemIsMovable);
+    styleIndex(StyleTable::defaultStyle(color)), isEditing(false), live(false),
+    modelSlot(-1), shapeId(0), owner(nullptr) {
+    if (type == ShapeType::Text) {
+        textData.reset(new TextData);
+        textData->staticText.setTextFormat(Qt::PlainText);
+        textData->staticText.setPerformanceHint(QStaticText::AggressiveCaching);
+        updateTextLayout();
+    }
+    updateGeometry();
+    setFlags(QGraphicsItem::ItemIsSelectable | QGraphicsItem::ItemIsMovable
+             | QGraphicsItem::ItemSendsGeometryChanges);
     setAcceptHoverEvents(true);
 }
 
+Shape::Shape(const Shape& source, QGraphicsItem* parent)
+    : QGraphicsItem(parent), type(source.type), startPos(source.startPos), endPos(source.endPos),
+    styleIndex(source.styleIndex),
+    textData(source.textData ? new TextData(*source.textData) : nullptr),
+    bounds(source.bounds), triangle(source.triangle), hitPath(source.hitPath),
+    isEditing(false), live(false), modelSlot(-1), shapeId(0), owner(nullptr) {
+    // Геометрия уже посчитана у исходной фигуры, updateGeometry() не нужен
+    setFlags(source.flags());
+    setAcceptHoverEvents(true);
+    setPos(source.pos());
+}
+
+Shape* Shape::clone() const {
+    return new Shape(*this, nullptr);
+}
+
+void* Shape::operator new(std::size_t size) {
+    return ShapePool::allocate(size);
+}
+
+void Shape::operator delete(void* block, std::size_t size) {
+    ShapePool::deallocate(block, size);
+}
+
+Shape::~Shape() {
+    if (resizeState.shape == this) {
+        FrameThrottle* throttle = frameThrottleOf(this);
+        if (throttle)
+            throttle->cancel();
+        resizeState = ResizeState();
+    }
+}
+
 QRectF Shape::boundingRect() const {
-    if (type == ShapeType::Text) {
-        QFontMetricsF metrics(font);
-        // Вычисляем границы текста с учетом выравнивания
-        QRectF textRect = metrics.boundingRect(QRectF(), Qt::AlignLeft | Qt::AlignTop, text);
-        // Смещаем прямоугольник к startPos (верхний левый угол текста)
-        textRect.moveTo(startPos);
-        // Добавляем отступы для рамки
-        return textRect.adjusted(-5, -5, 5, 5); // Уменьшаем отступы для более плотной рамки
+    PROFILE_COUNT(BoundingRectCalls);
+    return bounds;
+}
+
+QPainterPath Shape::shape() const {
+    prepareHitPath();
+    if (!isSelected() || type == ShapeType::Text)
+        return hitPath;
+
+    // Маркеры выделенной фигуры выходят за контур, но должны ловить мышь
+    QPainterPath path = hitPath;
+    for (int i = TopLeft; i <= BottomRight; ++i) {
+        path.addRect(getHandleRect(static_cast<ResizeHandle>(i)));
     }
-    QRectF rect(startPos, endPos);
-    rect = rect.normalized().adjusted(-10, -10, 10, 10);
-    return rect;
+    return path;
+}
+
+void Shape::prepareHitPath() const {
+    if (hitPath.isEmpty())
+        buildHitPath();
 }
 
 void Shape::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget) {
-    Q_UNUSED(option);
     Q_UNUSED(widget);
+    PROFILE_SCOPE("Shape::paint");
 
-    painter->setPen(QPen(color, 2));
-    painter->setFont(font);
+    // Неподвижные фигуры уже нарисованы в тайлах фона или пакетами BatchRenderer
+    CustomGraphicsScene* customScene = qobject_cast<CustomGraphicsScene*>(scene());
+    if (customScene && !isLive()
+        && (customScene->paintsStaticShapesFromTiles() || customScene->paintsShapeInBatch(this)))
+        return;
+    PROFILE_COUNT(ShapesPainted);
+
+    const ShapeStyle& style = StyleTable::style(styleIndex);
+    bool drawHandles = true;
+    if (levelOfDetailEnabled) {
+        const qreal lod = option->levelOfDetailFromTransform(painter->worldTransform());
+        const Detail detail = getDetail(lod);
+        if (detail == Detail::Hidden)
+            return;
+        if (detail == Detail::Box) {
+            painter->fillRect(bounds, style.color);
+            return;
+        }
+        if (lod < antialiasingScale)
+            painter->setRenderHint(QPainter::Antialiasing, false);
+        drawHandles = lod >= handlesScale;
+    }
+
+    painter->setPen(style.pen);
 
     switch(type) {
     case ShapeType::Line:
@@ -42,34 +150,27 @@ void Shape::paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWi
     case ShapeType::Ellipse:
         painter->drawEllipse(QRectF(startPos, endPos));
         break;
-    case ShapeType::Triangle: {
-        QPolygonF triangle;
-        triangle << QPointF((startPos.x() + endPos.x()) / 2, startPos.y()) // Верхняя вершина
-                 << QPointF(endPos.x(), endPos.y())                        // Правая нижняя
-                 << QPointF(startPos.x(), endPos.y());                      // Левая нижняя
+    case ShapeType::Triangle:
         painter->drawPolygon(triangle);
         break;
-    }
     case ShapeType::Text:
         if (!isEditing) {
             // Рисуем текст, интерпретируя startPos как верхний левый угол
-            painter->drawText(QRectF(startPos, QSizeF(1000, 1000)), Qt::AlignLeft | Qt::AlignTop, text);
+            painter->setFont(style.font);
+            painter->drawStaticText(startPos, textData->staticText);
         }
         break;
     }
 
     if (isSelected() || isEditing) {
         painter->setPen(QPen(Qt::blue, 1, Qt::DashLine));
-        QRectF rect = boundingRect().adjusted(5, 5, -5, -5);
-        painter->drawRect(rect);
+        painter->drawRect(bounds.adjusted(5, 5, -5, -5));
 
-        if (type != ShapeType::Text) {
+        if (type != ShapeType::Text && drawHandles) {
             painter->setBrush(Qt::white);
             painter->setPen(QPen(Qt::black, 1));
-
-            for (int i = 1; i <= 4; ++i) {
-                QRectF handle = getHandleRect(static_cast<ResizeHandle>(i));
-                painter->drawRect(handle);
+            for (int i = TopLeft; i <= BottomRight; ++i) {
+                painter->drawRect(getHandleRect(static_cast<ResizeHandle>(i)));
             }
         }
     }
@@ -89,104 +190,304 @@ Shape::ResizeHandle Shape::getResizeHandle(const QPointF& pos) const {
 }
 
 QRectF Shape::getHandleRect(ResizeHandle handle) const {
-    QRectF rect(startPos, endPos);
-    rect = rect.normalized();
-    const qreal handleSize = 8;
+    const QRectF rect = QRectF(startPos, endPos).normalized();
+    const QPointF offset(handleSize / 2, handleSize / 2);
+    const QSizeF size(handleSize, handleSize);
 
     switch(handle) {
-    case TopLeft:     return QRectF(rect.topLeft() - QPointF(handleSize/2, handleSize/2),
-                      QSizeF(handleSize, handleSize));
-    case TopRight:    return QRectF(rect.topRight() - QPointF(handleSize/2, handleSize/2),
-                      QSizeF(handleSize, handleSize));
-    case BottomLeft:  return QRectF(rect.bottomLeft() - QPointF(handleSize/2, handleSize/2),
-                      QSizeF(handleSize, handleSize));
-    case BottomRight: return QRectF(rect.bottomRight() - QPointF(handleSize/2, handleSize/2),
-                      QSizeF(handleSize, handleSize));
+    case TopLeft:     return QRectF(rect.topLeft() - offset, size);
+    case TopRight:    return QRectF(rect.topRight() - offset, size);
+    case BottomLeft:  return QRectF(rect.bottomLeft() - offset, size);
+    case BottomRight: return QRectF(rect.bottomRight() - offset, size);
     default: return QRectF();
     }
 }
 
+QPolygonF Shape::trianglePolygon(const QPointF& startPos, const QPointF& endPos) {
+    QPolygonF polygon;
+    polygon << QPointF((startPos.x() + endPos.x()) / 2, startPos.y()) // Верхняя вершина
+            << QPointF(endPos.x(), endPos.y())                        // Правая нижняя
+            << QPointF(startPos.x(), endPos.y());                      // Левая нижняя
+    return polygon;
+}
+
+void Shape::updateGeometry() {
+    if (owner)
+        owner->shapeGeometryChanged(this);
+
+    // Контур попадания нужен только при щелчке по фигуре - строится лениво
+    hitPath = QPainterPath();
+
+    if (type == ShapeType::Text) {
+        // Размер текста берется из кэша, startPos - верхний левый угол текста
+        bounds = QRectF(startPos, textData->size).adjusted(-5, -5, 5, 5);
+        return;
+    }
+
+    bounds = QRectF(startPos, endPos).normalized().adjusted(-10, -10, 10, 10);
+    if (type == ShapeType::Triangle)
+        triangle = trianglePolygon(startPos, endPos);
+}
+
+void Shape::buildHitPath() const {
+    if (type == ShapeType::Text) {
+        hitPath.addRect(bounds);
+        return;
+    }
+
+    QPainterPath outline;
+    switch(type) {
+    case ShapeType::Line:
+        outline.moveTo(startPos);
+        outline.lineTo(endPos);
+        break;
+    case ShapeType::Rectangle:
+        outline.addRect(QRectF(startPos, endPos));
+        break;
+    case ShapeType::Ellipse:
+        outline.addEllipse(QRectF(startPos, endPos));
+        break;
+    case ShapeType::Triangle:
+        outline.addPolygon(triangle);
+        outline.closeSubpath();
+        break;
+    default:
+        break;
+    }
+
+    // Контур с допуском для попадания мышью, замкнутые фигуры ловятся и изнутри
+    QPainterPathStroker stroker;
+    stroker.setWidth(8);
+    hitPath = stroker.createStroke(outline);
+    if (type != ShapeType::Line) {
+        hitPath = hitPath.united(outline);
+    }
+}
+
 void Shape::setEndPos(const QPointF& endPos) {
+    invalidateCachedTiles();
+    prepareGeometryChange();
+    this->endPos = endPos;
+    updateGeometry();
+    invalidateCachedTiles();
+    update();
+}
+
+void Shape::setGeometry(const QPointF& startPos, const QPointF& endPos) {
+    if (startPos == this->startPos && endPos == this->endPos)
+        return;
+
+    invalidateCachedTiles();
     prepareGeometryChange();
+    this->startPos = startPos;
     this->endPos = endPos;
+    updateGeometry();
+    invalidateCachedTiles();
     update();
 }
 
 void Shape::setText(const QString& text) {
+    if (!textData)
+        return; // Текст хранится только у текстовых фигур
+
+    invalidateCachedTiles();
     prepareGeometryChange();
-    this->text = text;
+    textData->text = text;
+    updateTextLayout();
+    updateGeometry();
+    invalidateCachedTiles();
     update();
 }
 
 void Shape::setColor(const QColor& color) {
-    this->color = color;
+    const ShapeStyle& style = StyleTable::style(styleIndex);
+    styleIndex = StyleTable::intern(color, style.penWidth, style.font);
+    invalidateCachedTiles();
     update();
 }
 
 void Shape::setEditing(bool editing) {
     isEditing = editing;
+    invalidateCachedTiles(true);
     update();
 }
 
+void Shape::setLive(bool live) {
+    if (this->live == live)
+        return;
+    this->live = live;
+    invalidateCachedTiles(true);
+    update();
+}
+
+bool Shape::isLive() const {
+    return live || isEditing || isSelected();
+}
+
+void Shape::invalidateCachedTiles(bool force) const {
+    // Живые фигуры в тайлы не попадают; force - при смене живая/неподвижная
+    if (!force && isLive())
+        return;
+
+    // Ячейки пакетной отрисовки сбрасываются вместе с тайлами
+    CustomGraphicsScene* customScene = qobject_cast<CustomGraphicsScene*>(scene());
+    if (customScene && (customScene->isTileCacheEnabled() || customScene->isBatchedRendering())) {
+        customScene->invalidateTiles(sceneBoundingRect());
+    }
+}
+
 void Shape::setFont(const QFont& font) {
+    invalidateCachedTiles();
     prepareGeometryChange();
-    this->font = font;
+    const ShapeStyle& style = StyleTable::style(styleIndex);
+    styleIndex = StyleTable::intern(style.color, style.penWidth, font);
+    updateTextLayout();
+    updateGeometry();
+    invalidateCachedTiles();
     update();
 }
 
+void Shape::updateTextLayout() {
+    if (!textData)
+        return;
+
+    const QFont& font = StyleTable::style(styleIndex).font;
+    QFontMetricsF metrics(font);
+    textData->size = metrics.boundingRect(QRectF(), Qt::AlignLeft | Qt::AlignTop, textData->text).size();
+    textData->staticText.setText(textData->text);
+    textData->staticText.prepare(QTransform(), font);
+}
+
+void Shape::setLevelOfDetailEnabled(bool enabled) {
+    levelOfDetailEnabled = enabled;
+}
+
+bool Shape::isLevelOfDetailEnabled() {
+    return levelOfDetailEnabled;
+}
+
+void Shape::setAntialiasingScale(qreal scale) {
+    antialiasingScale = scale;
+}
+
+qreal Shape::getAntialiasingScale() {
+    return antialiasingScale;
+}
+
+Shape::Detail Shape::getDetail(qreal lod) const {
+    if (!levelOfDetailEnabled)
+        return Detail::Full;
+
+    const qreal itemSize = qMax(bounds.width(), bounds.height()) * lod;
+    if (itemSize < hiddenItemSize)
+        return Detail::Hidden;
+    if (itemSize < tinyItemSize)
+        return Detail::Box;
+    return Detail::Full;
+}
+
 QFont Shape::getFont() const {
-    return font;
+    return StyleTable::style(styleIndex).font;
 }
 
+quint32 Shape::getId() const { return shapeId; }
 ShapeType Shape::getType() const { return type; }
-QColor Shape::getColor() const { return color; }
-QString Shape::getText() const { return text; }
+QColor Shape::getColor() const { return StyleTable::style(styleIndex).color; }
+const ShapeStyle& Shape::getStyle() const { return StyleTable::style(styleIndex); }
+QString Shape::getText() const { return textData ? textData->text : QString(); }
+QPointF Shape::getStartPos() const { return startPos; }
+QPointF Shape::getEndPos() const { return endPos; }
+
+qint64 Shape::memoryUsage() const {
+    qint64 bytes = sizeof(Shape) + triangle.capacity() * sizeof(QPointF)
+                   + hitPath.elementCount() * sizeof(QPainterPath::Element);
+    if (textData)
+        bytes += sizeof(TextData) + textData->text.capacity() * sizeof(QChar);
+    return bytes;
+}
 
 void Shape::mousePressEvent(QGraphicsSceneMouseEvent* event) {
     if (event->button() == Qt::LeftButton) {
-        currentHandle = getResizeHandle(event->pos());
-        isResizing = (currentHandle != None);
-
-        if (isResizing) {
-            resizeStartPos = startPos;
-            resizeStartEnd = endPos;
+        ResizeHandle handle = getResizeHandle(event->pos());
+        if (handle != None) {
+            resizeState.shape = this;
+            resizeState.handle = handle;
+            resizeState.startPos = startPos;
+            resizeState.endPos = endPos;
+            resizeState.pressPos = event->scenePos();
+            resizeState.targetStart = startPos;
+            resizeState.targetEnd = endPos;
+        } else if (resizeState.shape == this) {
+            resizeState = ResizeState();
         }
     }
     QGraphicsItem::mousePressEvent(event);
 }
 
 void Shape::mouseMoveEvent(QGraphicsSceneMouseEvent* event) {
-    prepareGeometryChange();
-    if (isResizing && (event->buttons() & Qt::LeftButton)) {
-        QPointF delta = event->scenePos() - event->lastScenePos();
+    if (resizeState.shape == this && (event->buttons() & Qt::LeftButton)) {
+        // Геометрия считается от начала перетаскивания, поэтому пропущенные
+        // между кадрами события ничего не теряют
+        const QPointF delta = event->scenePos() - resizeState.pressPos;
+        QPointF start = resizeState.startPos;
+        QPointF end = resizeState.endPos;
 
-        switch(currentHandle) {
+        switch(resizeState.handle) {
         case TopLeft:
-            startPos += delta;
+            start += delta;
             break;
         case TopRight:
-            endPos.setX(endPos.x() + delta.x());
-            startPos.setY(startPos.y() + delta.y());
+            end.setX(end.x() + delta.x());
+            start.setY(start.y() + delta.y());
             break;
         case BottomLeft:
-            startPos.setX(startPos.x() + delta.x());
-            endPos.setY(endPos.y() + delta.y());
+            start.setX(start.x() + delta.x());
+            end.setY(end.y() + delta.y());
             break;
         case BottomRight:
-            endPos += delta;
+            end += delta;
             break;
         default:
             break;
         }
-        update();
+        resizeState.targetStart = start;
+        resizeState.targetEnd = end;
+
+        FrameThrottle* throttle = frameThrottleOf(this);
+        if (throttle) {
+            throttle->request(applyPendingResize);
+        } else {
+            applyPendingResize();
+        }
+    } else if ((event->buttons() & Qt::LeftButton) && (flags() & ItemIsMovable)
+               && qobject_cast<CustomGraphicsScene*>(scene())) {
+        // Вместо поэлементного перемещения QGraphicsItem двигаем всё выделение разом
+        CustomGraphicsScene* customScene = static_cast<CustomGraphicsScene*>(scene());
+        customScene->moveSelection(event->scenePos() - event->buttonDownScenePos(Qt::LeftButton));
     } else {
         QGraphicsItem::mouseMoveEvent(event);
     }
 }
 
 void Shape::mouseReleaseEvent(QGraphicsSceneMouseEvent* event) {
-    isResizing = false;
-    currentHandle = None;
+    if (resizeState.shape == this) {
+        FrameThrottle* throttle = frameThrottleOf(this);
+        if (throttle)
+            throttle->flush();
+
+        const ResizeState finished = resizeState;
+        resizeState = ResizeState();
+        if (startPos != finished.startPos || endPos != finished.endPos) {
+            // Команду отмены записывает контроллер
+            CustomGraphicsScene* customScene = qobject_cast<CustomGraphicsScene*>(scene());
+            if (customScene)
+                customScene->notifyShapeResized(this, finished.startPos, finished.endPos);
+        }
+    }
+
+    CustomGraphicsScene* customScene = qobject_cast<CustomGraphicsScene*>(scene());
+    if (customScene)
+        customScene->finishSelectionMove();
     QGraphicsItem::mouseReleaseEvent(event);
 }
 
@@ -208,3 +509,24 @@ void Shape::hoverMoveEvent(QGraphicsSceneHoverEvent* event) {
 
     QGraphicsItem::hoverMoveEvent(event);
 }
+
+QVariant Shape::itemChange(GraphicsItemChange change, const QVariant& value) {
+    switch (change) {
+    case ItemPositionHasChanged: // Новое место фигуры
+        if (owner)
+            owner->shapeGeometryChanged(this);
+        invalidateCachedTiles();
+        break;
+    case ItemPositionChange:     // Старое место фигуры
+    case ItemSceneChange:
+    case ItemSceneHasChanged:
+        invalidateCachedTiles();
+        break;
+    case ItemSelectedHasChanged:
+        invalidateCachedTiles(true);
+        break;
+    default:
+        break;
+    }
+    return QGraphicsItem::itemChange(change, value);
+}
@@ -5,50 +5,114 @@
 #include <QPainter>
 #include <QColor>
 #include <QFont>
+#include <QStaticText>
+#include <QPainterPath>
 #include <QGraphicsSceneMouseEvent>
+#include <QScopedPointer>
+#include <cstddef>
+#include "shapestyle.h"
+
+class GraphicModel;
 
 enum class ShapeType { Line, Rectangle, Ellipse, Text, Triangle};
 
 class Shape : public QGraphicsItem {
 public:
     Shape(ShapeType type, const QPointF& startPos, const QColor& color, QGraphicsItem* parent = nullptr);
+    ~Shape() override;
+
+    // Копия без id и владельца. Контур, треугольник и текст - неявно общие
+    // данные Qt: копия делит их с исходной фигурой, пока одна из них не изменится.
+    Shape* clone() const;
+
+    // Фигуры размещаются в ShapePool
+    static void* operator new(std::size_t size);
+    static void operator delete(void* block, std::size_t size);
 
     QRectF boundingRect() const override;
+    QPainterPath shape() const override;
+    // Контур попадания строится при первом shape(); вставляемые фигуры
+    // получают его заранее, в пуле ModelJobs
+    void prepareHitPath() const;
     void paint(QPainter* painter, const QStyleOptionGraphicsItem* option, QWidget* widget = nullptr) override;
 
     void setEndPos(const QPointF& endPos);
+    void setGeometry(const QPointF& startPos, const QPointF& endPos);
     void setText(const QString& text);
     void setColor(const QColor& color);
     void setEditing(bool editing);
+    void setLive(bool live);  // Фигура меняется каждый кадр и не кэшируется в тайлах
+    bool isLive() const;
     void setFont(const QFont& font); // Новый метод для установки шрифта
     QFont getFont() const;           // Новый метод для получения шрифта
 
+    // Упрощенная отрисовка при сильном отдалении
+    static void setLevelOfDetailEnabled(bool enabled);
+    static bool isLevelOfDetailEnabled();
+    static void setAntialiasingScale(qreal scale); // Ниже этого масштаба сглаживание отключается
+    static qreal getAntialiasingScale();
+
+    // Как фигура рисуется при масштабе lod: общее правило для paint() и BatchRenderer
+    enum class Detail { Hidden, Box, Full };
+    Detail getDetail(qreal lod) const;
+
+    // Треугольник, вписанный в прямоугольник startPos-endPos (вершина сверху)
+    static QPolygonF trianglePolygon(const QPointF& startPos, const QPointF& endPos);
+
+    quint32 getId() const; // Постоянный идентификатор в модели, 0 - еще не назначен
     ShapeType getType() const;
     QColor getColor() const;
+    const ShapeStyle& getStyle() const;
     QString getText() const;
+    QPointF getStartPos() const;
+    QPointF getEndPos() const;
+    qint64 memoryUsage() const; // Приблизительно, для учета памяти истории отмены
 
 protected:
     void mousePressEvent(QGraphicsSceneMouseEvent* event) override;
     void mouseMoveEvent(QGraphicsSceneMouseEvent* event) override;
     void mouseReleaseEvent(QGraphicsSceneMouseEvent* event) override;
     void hoverMoveEvent(QGraphicsSceneHoverEvent* event) override;
+    QVariant itemChange(GraphicsItemChange change, const QVariant& value) override;
 
 private:
+    friend class GraphicModel;
+    friend class ShapeDocument;
+    friend class BatchRenderer;
+
+    Shape(const Shape& source, QGraphicsItem* parent);
+
     enum ResizeHandle { None, TopLeft, TopRight, BottomLeft, BottomRight };
     ResizeHandle getResizeHandle(const QPointF& pos) const;
     QRectF getHandleRect(ResizeHandle handle) const;
+    void updateTextLayout();
+    void updateGeometry();
+    void buildHitPath() const;
+    void invalidateCachedTiles(bool force = false) const;
+
+    // Данные, которые есть только у текстовых фигур
+    struct TextData {
+        QString text;
+        QStaticText staticText; // Раскладка текста, обновляется в setText/setFont
+        QSizeF size;
+    };
 
     ShapeType type;
     QPointF startPos;
     QPointF endPos;
-    QColor color;
-    QString text;
-    QFont font; // Новое поле для шрифта
+    quint32 styleIndex; // Цвет, перо и шрифт в StyleTable
+    QScopedPointer<TextData> textData;
+    // Кэш геометрии, перестраивается в updateGeometry() при изменении размеров
+    QRectF bounds;
+    QPolygonF triangle;
+    // Строится при первом shape() после изменения; пустой - еще не построен
+    mutable QPainterPath hitPath;
     bool isEditing;
-    ResizeHandle currentHandle;
-    bool isResizing;
-    QPointF resizeStartPos;
-    QPointF resizeStartEnd;
+    bool live;
+    int modelSlot; // Индекс в хранилище GraphicModel, -1 если фигура не в модели
+    quint32 shapeId;
+    GraphicModel* owner;
+    QRectF indexedRect; // Прямоугольник, с которым фигура лежит в пространственном индексе
 };
 
 #endif // SHAPE_H
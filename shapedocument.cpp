@@ -0,0 +1,350 @@
+#include "shapedocument.h"
+#include <QSaveFile>
+#include <QtEndian>
+#include <cstring>
+#include "graphicmodel.h"
+
+namespace {
+const char magic[4] = { 'S', 'H', 'P', 'D' };
+const int headerSize = 40;
+const int recordSizeV1 = 40;
+const int recordSizeV2 = 44; // + id фигуры
+const quint32 noString = 0xFFFFFFFF;
+
+void putFloat(uchar* dest, float value) {
+    quint32 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    qToLittleEndian(bits, dest);
+}
+
+float getFloat(const uchar* src) {
+    const quint32 bits = qFromLittleEndian<quint32>(src);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void writeRecord(uchar* r, const Shape* shape, quint32 textIndex, quint32 fontIndex) {
+    r[0] = static_cast<uchar>(shape->getType());
+    qToLittleEndian<quint32>(shape->getColor().rgba(), r + 4);
+    qToLittleEndian<quint32>(textIndex, r + 8);
+    qToLittleEndian<quint32>(fontIndex, r + 12);
+    putFloat(r + 16, shape->getStartPos().x());
+    putFloat(r + 20, shape->getStartPos().y());
+    putFloat(r + 24, shape->getEndPos().x());
+    putFloat(r + 28, shape->getEndPos().y());
+    putFloat(r + 32, shape->pos().x());
+    putFloat(r + 36, shape->pos().y());
+    qToLittleEndian<quint32>(shape->getId(), r + 40);
+}
+
+// Создает фигуру из записи; текст и шрифт передаются уже разрешенными
+Shape* readRecord(const uchar* r, const QString& text, const QFont* font) {
+    if (r[0] > static_cast<uchar>(ShapeType::Triangle))
+        return nullptr;
+
+    const ShapeType type = static_cast<ShapeType>(r[0]);
+    const QColor color = QColor::fromRgba(qFromLittleEndian<quint32>(r + 4));
+    Shape* shape = new Shape(type, QPointF(getFloat(r + 16), getFloat(r + 20)), color);
+
+    if (type == ShapeType::Text) {
+        if (font)
+            shape->setFont(*font);
+        shape->setText(text);
+    } else {
+        shape->setEndPos(QPointF(getFloat(r + 24), getFloat(r + 28)));
+    }
+    shape->setPos(getFloat(r + 32), getFloat(r + 36));
+    return shape;
+}
+
+quint32 readId(const uchar* r, int recordSize) {
+    return recordSize >= recordSizeV2 ? qFromLittleEndian<quint32>(r + 40) : 0;
+}
+
+void appendString(QByteArray& bytes, const QByteArray& value) {
+    uchar length[4];
+    qToLittleEndian<quint32>(value.size(), length);
+    bytes.append(reinterpret_cast<const char*>(length), sizeof(length));
+    bytes.append(value);
+}
+}
+
+ShapeDocument::ShapeDocument()
+    : data(nullptr), size(0), recordSize(0), recordCount(0), stringCount(0),
+    recordsOffset(0), stringsOffset(0), documentGeneration(0) {}
+
+ShapeDocument::~ShapeDocument() {
+    close();
+}
+
+ShapeDocument::Snapshot ShapeDocument::snapshot(const ShapeRange& shapes) {
+    Snapshot snapshot;
+    snapshot.records = QByteArray(shapes.size() * recordSizeV2, '\0');
+
+    uchar* r = reinterpret_cast<uchar*>(snapshot.records.data());
+    int index = 0;
+    for (Shape* shape : shapes) {
+        writeRecord(r, shape, noString, noString);
+        if (shape->getType() == ShapeType::Text)
+            snapshot.texts.append({ index, shape->getText(), shape->getFont() });
+        r += recordSizeV2;
+        ++index;
+    }
+    return snapshot;
+}
+
+QByteArray ShapeDocument::serialize(const ShapeRange& shapes, quint64 generation) {
+    return serialize(snapshot(shapes), generation);
+}
+
+QByteArray ShapeDocument::serialize(const Snapshot& snapshot, quint64 generation) {
+    QByteArray records = snapshot.records;
+    const int recordCount = records.size() / recordSizeV2;
+    QList<QByteArray> strings;
+    QHash<QString, quint32> stringIndex;
+
+    auto intern = [&](const QString& value) -> quint32 {
+        auto it = stringIndex.constFind(value);
+        if (it != stringIndex.constEnd())
+            return it.value();
+        const quint32 index = strings.size();
+        strings.append(value.toUtf8());
+        stringIndex.insert(value, index);
+        return index;
+    };
+
+    uchar* first = reinterpret_cast<uchar*>(records.data());
+    for (const Snapshot::Text& text : snapshot.texts) {
+        uchar* r = first + text.record * recordSizeV2;
+        qToLittleEndian<quint32>(intern(text.text), r + 8);
+        qToLittleEndian<quint32>(intern(text.font.toString()), r + 12);
+    }
+
+    const quint64 stringsOffset = headerSize + quint64(records.size());
+    uchar header[headerSize] = {};
+    std::memcpy(header, magic, sizeof(magic));
+    qToLittleEndian<quint16>(Version, header + 4);
+    qToLittleEndian<quint16>(recordSizeV2, header + 6);
+    qToLittleEndian<quint32>(recordCount, header + 8);
+    qToLittleEndian<quint32>(strings.size(), header + 12);
+    qToLittleEndian<quint64>(headerSize, header + 16);
+    qToLittleEndian<quint64>(stringsOffset, header + 24);
+    qToLittleEndian<quint64>(generation, header + 32);
+
+    // Таблица смещений строк, затем сами строки с длиной впереди
+    QByteArray offsets(strings.size() * 8, '\0');
+    quint64 offset = stringsOffset + offsets.size();
+    for (int i = 0; i < strings.size(); ++i) {
+        qToLittleEndian<quint64>(offset, reinterpret_cast<uchar*>(offsets.data()) + i * 8);
+        offset += 4 + strings.at(i).size();
+    }
+
+    QByteArray bytes;
+    bytes.reserve(offset);
+    bytes.append(reinterpret_cast<const char*>(header), headerSize);
+    bytes.append(records);
+    bytes.append(offsets);
+    for (const QByteArray& value : strings) {
+        appendString(bytes, value);
+    }
+    return bytes;
+}
+
+bool ShapeDocument::save(const QString& fileName, const ShapeRange& shapes, QString* errorString) {
+    return save(fileName, snapshot(shapes), errorString);
+}
+
+bool ShapeDocument::save(const QString& fileName, const Snapshot& snapshot, QString* errorString) {
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+    file.write(serialize(snapshot));
+    if (!file.commit()) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+QByteArray ShapeDocument::encodeShape(const Shape* shape) {
+    QByteArray bytes(recordSizeV2, '\0');
+    writeRecord(reinterpret_cast<uchar*>(bytes.data()), shape, noString, noString);
+    if (shape->getType() == ShapeType::Text) {
+        appendString(bytes, shape->getText().toUtf8());
+        appendString(bytes, shape->getFont().toString().toUtf8());
+    }
+    return bytes;
+}
+
+Shape* ShapeDocument::decodeShape(const QByteArray& bytes) {
+    if (bytes.size() < recordSizeV2)
+        return nullptr;
+
+    const uchar* r = reinterpret_cast<const uchar*>(bytes.constData());
+    QString strings[2];
+    int offset = recordSizeV2;
+    for (QString& value : strings) {
+        if (offset + 4 > bytes.size())
+            break;
+        const quint32 length = qFromLittleEndian<quint32>(r + offset);
+        if (length > quint32(bytes.size() - offset - 4))
+            return nullptr;
+        value = QString::fromUtf8(bytes.constData() + offset + 4, length);
+        offset += 4 + length;
+    }
+
+    QFont font;
+    const bool hasFont = !strings[1].isEmpty() && font.fromString(strings[1]);
+    Shape* shape = readRecord(r, strings[0], hasFont ? &font : nullptr);
+    if (shape)
+        shape->shapeId = readId(r, recordSizeV2);
+    return shape;
+}
+
+bool ShapeDocument::open(const QString& fileName) {
+    close();
+
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return fail(file.errorString());
+
+    size = file.size();
+    if (size < headerSize)
+        return fail(QStringLiteral("File is too small"));
+
+    data = file.map(0, size);
+    if (!data)
+        return fail(file.errorString());
+    return readHeader();
+}
+
+bool ShapeDocument::openData(const QByteArray& bytes) {
+    close();
+
+    buffer = bytes;
+    size = buffer.size();
+    if (size < headerSize)
+        return fail(QStringLiteral("Data is too small"));
+    data = reinterpret_cast<const uchar*>(buffer.constData());
+    return readHeader();
+}
+
+bool ShapeDocument::readHeader() {
+    if (std::memcmp(data, magic, sizeof(magic)) != 0)
+        return fail(QStringLiteral("Not a shape document"));
+
+    const quint16 version = qFromLittleEndian<quint16>(data + 4);
+    recordSize = qFromLittleEndian<quint16>(data + 6);
+    if (version == 0 || version > Version)
+        return fail(QStringLiteral("Unsupported document version"));
+    if (recordSize != (version == 1 ? recordSizeV1 : recordSizeV2))
+        return fail(QStringLiteral("Unexpected record size"));
+
+    recordCount = qFromLittleEndian<quint32>(data + 8);
+    stringCount = qFromLittleEndian<quint32>(data + 12);
+    recordsOffset = qFromLittleEndian<quint64>(data + 16);
+    stringsOffset = qFromLittleEndian<quint64>(data + 24);
+    documentGeneration = qFromLittleEndian<quint64>(data + 32);
+
+    if (recordsOffset + quint64(recordCount) * recordSize > quint64(size)
+        || stringsOffset + quint64(stringCount) * 8 > quint64(size)) {
+        return fail(QStringLiteral("Document is truncated"));
+    }
+    return true;
+}
+
+void ShapeDocument::close() {
+    if (data && buffer.isNull())
+        file.unmap(const_cast<uchar*>(data));
+    file.close();
+    buffer.clear();
+    data = nullptr;
+    size = 0;
+    recordSize = 0;
+    recordCount = 0;
+    stringCount = 0;
+    documentGeneration = 0;
+    fonts.clear();
+}
+
+QString ShapeDocument::errorString() const {
+    return error;
+}
+
+quint64 ShapeDocument::generation() const {
+    return documentGeneration;
+}
+
+int ShapeDocument::shapeCount() const {
+    return recordCount;
+}
+
+quint32 ShapeDocument::shapeId(int index) const {
+    return readId(record(index), recordSize);
+}
+
+void ShapeDocument::resolveFonts() {
+    for (quint32 index = 0; index < recordCount; ++index) {
+        const uchar* r = record(int(index));
+        if (r[0] != static_cast<uchar>(ShapeType::Text))
+            continue;
+        const quint32 fontIndex = qFromLittleEndian<quint32>(r + 12);
+        if (fontIndex != noString && !fonts.contains(fontIndex)) {
+            QFont font;
+            font.fromString(string(fontIndex));
+            fonts.insert(fontIndex, font);
+        }
+    }
+}
+
+Shape* ShapeDocument::createShape(int index) {
+    const uchar* r = record(index);
+    Shape* shape = nullptr;
+
+    if (r[0] == static_cast<uchar>(ShapeType::Text)) {
+        const quint32 fontIndex = qFromLittleEndian<quint32>(r + 12);
+        if (fontIndex != noString && !fonts.contains(fontIndex)) {
+            QFont font;
+            font.fromString(string(fontIndex));
+            fonts.insert(fontIndex, font);
+        }
+        const QString text = string(qFromLittleEndian<quint32>(r + 8));
+        const auto font = fonts.constFind(fontIndex);
+        shape = readRecord(r, text, font != fonts.constEnd() ? &font.value() : nullptr);
+    } else {
+        shape = readRecord(r, QString(), nullptr);
+    }
+
+    if (shape)
+        shape->shapeId = readId(r, recordSize);
+    return shape;
+}
+
+const uchar* ShapeDocument::record(int index) const {
+    Q_ASSERT(index >= 0 && quint32(index) < recordCount);
+    return data + recordsOffset + quint64(index) * recordSize;
+}
+
+QString ShapeDocument::string(quint32 index) const {
+    if (index >= stringCount)
+        return QString();
+
+    const quint64 offset = qFromLittleEndian<quint64>(data + stringsOffset + quint64(index) * 8);
+    if (offset + 4 > quint64(size))
+        return QString();
+    const quint32 length = qFromLittleEndian<quint32>(data + offset);
+    if (offset + 4 + length > quint64(size))
+        return QString();
+    return QString::fromUtf8(reinterpret_cast<const char*>(data + offset + 4), length);
+}
+
+bool ShapeDocument::fail(const QString& message) {
+    close();
+    error = message;
+    return false;
+}
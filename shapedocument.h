@@ -0,0 +1,86 @@
+#ifndef SHAPEDOCUMENT_H
+#define SHAPEDOCUMENT_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include "shape.h"
+
+class ShapeRange;
+
+// Двоичный формат документа (все числа little-endian):
+//   заголовок  - магия "SHPD", версия, число записей и строк, смещения таблиц,
+//                поколение (используется автосохранением);
+//   записи     - фиксированного размера: тип, цвет, индексы текста и шрифта,
+//                startPos/endPos/pos во float, id фигуры (с версии 2);
+//   строки     - таблица смещений и UTF-8 данные (тексты и QFont::toString()).
+// Файл отображается в память, фигуры создаются по индексу записи.
+// Тот же формат служит форматом буфера обмена.
+class ShapeDocument {
+public:
+    static const quint16 Version = 2;
+
+    ShapeDocument();
+    ~ShapeDocument();
+
+    // Снимок фигур для сериализации в другом потоке. Снимается на потоке GUI
+    // одним проходом: записи без индексов строк и неявно общие копии текстов и
+    // шрифтов; интернирование строк и UTF-8 остаются serialize().
+    struct Snapshot {
+        struct Text {
+            int record;
+            QString text;
+            QFont font;
+        };
+        QByteArray records;
+        QVector<Text> texts;
+    };
+    static Snapshot snapshot(const ShapeRange& shapes);
+
+    static QByteArray serialize(const Snapshot& snapshot, quint64 generation = 0);
+    static QByteArray serialize(const ShapeRange& shapes, quint64 generation = 0);
+    static bool save(const QString& fileName, const ShapeRange& shapes,
+                     QString* errorString = nullptr);
+    static bool save(const QString& fileName, const Snapshot& snapshot,
+                     QString* errorString = nullptr);
+
+    // Одна фигура вместе со своими строками, для журнала и буфера обмена
+    static QByteArray encodeShape(const Shape* shape);
+    static Shape* decodeShape(const QByteArray& bytes);
+
+    bool open(const QString& fileName);
+    bool openData(const QByteArray& bytes); // Документ в памяти, например из буфера обмена
+    void close();
+    QString errorString() const;
+
+    quint64 generation() const;
+    int shapeCount() const;
+    quint32 shapeId(int index) const;
+    // После resolveFonts() createShape() только читает документ
+    // и его можно вызывать из нескольких потоков сразу
+    void resolveFonts();
+    Shape* createShape(int index);
+
+private:
+    const uchar* record(int index) const;
+    QString string(quint32 index) const;
+    bool fail(const QString& message);
+    bool readHeader();
+
+    QFile file;
+    QByteArray buffer;
+    const uchar* data;
+    qint64 size;
+    quint16 recordSize;
+    quint32 recordCount;
+    quint32 stringCount;
+    quint64 recordsOffset;
+    quint64 stringsOffset;
+    quint64 documentGeneration;
+    QHash<quint32, QFont> fonts;
+    QString error;
+};
+
+#endif // SHAPEDOCUMENT_H
@@ -0,0 +1,133 @@
+#include "shapepool.h"
+#include <QAtomicInt>
+#include <QMutex>
+#include <QVector>
+#include <new>
+#include "shape.h"
+
+namespace {
+const std::size_t blockSize = (sizeof(Shape) + alignof(std::max_align_t) - 1)
+                              / alignof(std::max_align_t) * alignof(std::max_align_t);
+const int blocksPerChunk = 1024;
+const int cacheBatch = 64; // Блоков за одно обращение к общему списку
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+struct Pool {
+    QMutex mutex;
+    QVector<char*> chunks;
+    FreeBlock* freeList = nullptr;
+    int outstanding = 0; // Блоки вне общего списка: у фигур и в кэшах потоков
+    QAtomicInt live;
+};
+
+Pool& pool() {
+    static Pool instance;
+    return instance;
+}
+
+// Свободные блоки одного потока: allocate/deallocate идут без блокировки,
+// общий список трогается пачками по cacheBatch блоков. Загрузка в пуле
+// потоков создает фигуры сразу в нескольких потоках.
+struct ThreadCache {
+    ~ThreadCache() { release(count); }
+
+    void refill() {
+        Pool& p = pool();
+        QMutexLocker locker(&p.mutex);
+        for (int i = 0; i < cacheBatch; ++i) {
+            if (!p.freeList) {
+                char* chunk = static_cast<char*>(::operator new(blockSize * blocksPerChunk));
+                p.chunks.append(chunk);
+                for (int j = blocksPerChunk - 1; j >= 0; --j) {
+                    FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + j * blockSize);
+                    block->next = p.freeList;
+                    p.freeList = block;
+                }
+            }
+            FreeBlock* block = p.freeList;
+            p.freeList = block->next;
+            block->next = head;
+            head = block;
+        }
+        count += cacheBatch;
+        p.outstanding += cacheBatch;
+    }
+
+    void release(int blocks) {
+        if (blocks <= 0)
+            return;
+        FreeBlock* first = head;
+        FreeBlock* last = head;
+        for (int i = 1; i < blocks; ++i) {
+            last = last->next;
+        }
+        head = last->next;
+        count -= blocks;
+
+        Pool& p = pool();
+        QMutexLocker locker(&p.mutex);
+        last->next = p.freeList;
+        p.freeList = first;
+        p.outstanding -= blocks;
+    }
+
+    FreeBlock* head = nullptr;
+    int count = 0;
+};
+
+thread_local ThreadCache cache;
+}
+
+void* ShapePool::allocate(std::size_t size) {
+    if (size > blockSize)
+        return ::operator new(size);
+
+    if (!cache.head)
+        cache.refill();
+    FreeBlock* block = cache.head;
+    cache.head = block->next;
+    --cache.count;
+    pool().live.fetchAndAddRelaxed(1);
+    return block;
+}
+
+void ShapePool::deallocate(void* block, std::size_t size) {
+    if (!block)
+        return;
+    if (size > blockSize) {
+        ::operator delete(block);
+        return;
+    }
+
+    FreeBlock* freeBlock = static_cast<FreeBlock*>(block);
+    freeBlock->next = cache.head;
+    cache.head = freeBlock;
+    ++cache.count;
+    pool().live.fetchAndAddRelaxed(-1);
+    if (cache.count > 2 * cacheBatch)
+        cache.release(cacheBatch);
+}
+
+void ShapePool::trim() {
+    // Блоки в кэшах других потоков не дают вернуть куски: они вернутся
+    // в общий список, когда поток завершится
+    cache.release(cache.count);
+
+    Pool& p = pool();
+    QMutexLocker locker(&p.mutex);
+    if (p.outstanding > 0)
+        return;
+
+    for (char* chunk : p.chunks) {
+        ::operator delete(chunk);
+    }
+    p.chunks.clear();
+    p.freeList = nullptr;
+}
+
+int ShapePool::liveCount() {
+    return pool().live.loadRelaxed();
+}
@@ -0,0 +1,18 @@
+#ifndef SHAPEPOOL_H
+#define SHAPEPOOL_H
+
+#include <cstddef>
+
+// Пул блоков фиксированного размера для объектов Shape.
+// Память берется кусками по много блоков сразу, освобожденные блоки
+// идут в список свободных своего потока и пачками - в общий; trim()
+// возвращает куски системе целиком, когда все блоки снова в общем списке.
+class ShapePool {
+public:
+    static void* allocate(std::size_t size);
+    static void deallocate(void* block, std::size_t size);
+    static void trim();
+    static int liveCount();
+};
+
+#endif // SHAPEPOOL_H
@@ -0,0 +1,94 @@
+#include "shapestyle.h"
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QByteArray>
+#include <QHash>
+#include <QReadWriteLock>
+
+namespace {
+const int chunkBits = 10;
+const quint32 chunkSize = 1u << chunkBits;
+const int maxChunks = 1 << 12; // До 4M разных стилей
+
+typedef QAtomicPointer<const ShapeStyle> StyleSlot;
+
+// Стили выделяются по одному и не перемещаются. Указатели на них лежат в
+// кусках фиксированного размера; кусок и указатель публикуются под блокировкой
+// записи (store-release), style() читает их без блокировки (load-acquire).
+struct Table {
+    ~Table() {
+        for (int i = 0; i < maxChunks; ++i) {
+            StyleSlot* chunk = chunks[i].loadRelaxed();
+            if (!chunk)
+                break;
+            for (quint32 j = 0; j < chunkSize; ++j) {
+                delete chunk[j].loadRelaxed();
+            }
+            delete[] chunk;
+        }
+    }
+
+    QAtomicPointer<StyleSlot> chunks[maxChunks];
+    QAtomicInteger<quint32> count;
+    QHash<QByteArray, quint32> index;
+    QFont defaultFont = QFont("Arial", 12);
+    QReadWriteLock lock; // Для index и записи новых стилей
+};
+
+Table& table() {
+    static Table instance;
+    return instance;
+}
+
+QByteArray styleKey(const QColor& color, qreal penWidth, const QFont& font) {
+    const QRgb rgba = color.rgba();
+    QByteArray key(reinterpret_cast<const char*>(&rgba), sizeof(rgba));
+    key.append(reinterpret_cast<const char*>(&penWidth), sizeof(penWidth));
+    key.append(font.key().toUtf8());
+    return key;
+}
+}
+
+quint32 StyleTable::intern(const QColor& color, qreal penWidth, const QFont& font) {
+    Table& t = table();
+    const QByteArray key = styleKey(color, penWidth, font);
+
+    {
+        QReadLocker locker(&t.lock);
+        auto it = t.index.constFind(key);
+        if (it != t.index.constEnd())
+            return it.value();
+    }
+
+    QWriteLocker locker(&t.lock);
+    auto it = t.index.constFind(key);
+    if (it != t.index.constEnd())
+        return it.value(); // Другой поток успел добавить
+
+    const quint32 index = t.count.loadRelaxed();
+    Q_ASSERT(index >> chunkBits < quint32(maxChunks));
+    StyleSlot* chunk = t.chunks[index >> chunkBits].loadRelaxed();
+    if (!chunk) {
+        chunk = new StyleSlot[chunkSize];
+        t.chunks[index >> chunkBits].storeRelease(chunk);
+    }
+    chunk[index & (chunkSize - 1)].storeRelease(
+        new ShapeStyle{ color, penWidth, font, QPen(color, penWidth) });
+    t.count.storeRelease(index + 1);
+    t.index.insert(key, index);
+    return index;
+}
+
+quint32 StyleTable::defaultStyle(const QColor& color) {
+    return intern(color, 2, table().defaultFont);
+}
+
+const ShapeStyle& StyleTable::style(quint32 index) {
+    const Table& t = table();
+    const StyleSlot* chunk = t.chunks[index >> chunkBits].loadAcquire();
+    return *chunk[index & (chunkSize - 1)].loadAcquire();
+}
+
+int StyleTable::size() {
+    return int(table().count.loadAcquire());
+}
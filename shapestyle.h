@@ -0,0 +1,29 @@
+#ifndef SHAPESTYLE_H
+#define SHAPESTYLE_H
+
+#include <QColor>
+#include <QFont>
+#include <QPen>
+
+// Стиль фигуры. Одинаковые стили хранятся в StyleTable один раз,
+// фигура держит только индекс.
+struct ShapeStyle {
+    QColor color;
+    qreal penWidth;
+    QFont font;
+    QPen pen; // Готовое перо из color и penWidth
+};
+
+// Общая таблица стилей, доступна из любых потоков (пакетный режим).
+// Записи не удаляются и не перемещаются, поэтому ссылки из style()
+// действительны всегда; style() вызывается при каждой отрисовке и
+// не берет блокировок, intern() блокирует только при добавлении.
+class StyleTable {
+public:
+    static quint32 intern(const QColor& color, qreal penWidth, const QFont& font);
+    static quint32 defaultStyle(const QColor& color); // Перо 2, шрифт Arial 12
+    static const ShapeStyle& style(quint32 index);
+    static int size();
+};
+
+#endif // SHAPESTYLE_H
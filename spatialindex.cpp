@@ -0,0 +1,324 @@
+#include "spatialindex.h"
+#include <QHash>
+#include <QtMath>
+#include <algorithm>
+#include "shape.h"
+
+namespace {
+// QRectF::intersects и united пропускают вырожденные прямоугольники,
+// а у горизонтальной линии или точки высота бывает нулевой
+bool overlaps(const QRectF& a, const QRectF& b) {
+    return a.left() <= b.right() && b.left() <= a.right()
+           && a.top() <= b.bottom() && b.top() <= a.bottom();
+}
+
+QRectF merged(const QRectF& a, const QRectF& b) {
+    return QRectF(QPointF(qMin(a.left(), b.left()), qMin(a.top(), b.top())),
+                  QPointF(qMax(a.right(), b.right()), qMax(a.bottom(), b.bottom())));
+}
+
+qreal area(const QRectF& rect) {
+    return rect.width() * rect.height();
+}
+
+qreal distanceTo(const QRectF& rect, const QPointF& pos) {
+    const qreal dx = qMax(qMax(rect.left() - pos.x(), pos.x() - rect.right()), 0.0);
+    const qreal dy = qMax(qMax(rect.top() - pos.y(), pos.y() - rect.bottom()), 0.0);
+    return qSqrt(dx * dx + dy * dy);
+}
+
+// Равномерная сетка: ячейки хранятся в хэше, поэтому пустые места ничего не стоят
+class GridIndex : public SpatialIndex {
+public:
+    explicit GridIndex(qreal cellSize = 128) : cellSize(cellSize) {}
+
+    SpatialIndexType type() const override { return SpatialIndexType::Grid; }
+
+    void insert(Shape* shape, const QRectF& rect) override {
+        forEachCell(rect, [&](quint64 key) {
+            cells[key].append(Entry{ shape, rect });
+        });
+        extent = extent.isNull() ? rect : merged(extent, rect);
+    }
+
+    void remove(Shape* shape, const QRectF& rect) override {
+        forEachCell(rect, [&](quint64 key) {
+            auto it = cells.find(key);
+            if (it == cells.end())
+                return;
+            QVector<Entry>& entries = it.value();
+            for (int i = 0; i < entries.size(); ++i) {
+                if (entries.at(i).shape == shape) {
+                    entries[i] = entries.last();
+                    entries.removeLast();
+                    break;
+                }
+            }
+            if (entries.isEmpty())
+                cells.erase(it);
+        });
+    }
+
+    void clear() override {
+        cells.clear();
+        extent = QRectF();
+    }
+
+    void query(const QRectF& rect, QVector<Shape*>& result) const override {
+        forEachCell(rect, [&](quint64 key) {
+            auto it = cells.constFind(key);
+            if (it == cells.constEnd())
+                return;
+            for (const Entry& entry : it.value()) {
+                if (!overlaps(entry.rect, rect))
+                    continue;
+                // Фигура в нескольких ячейках попадает в ответ один раз:
+                // из ячейки, где лежит угол пересечения
+                const QPointF corner(qMax(entry.rect.left(), rect.left()),
+                                     qMax(entry.rect.top(), rect.top()));
+                if (cellKey(cellOf(corner.x()), cellOf(corner.y())) == key)
+                    result.append(entry.shape);
+            }
+        });
+    }
+
+    QRectF bounds() const override { return extent; }
+
+private:
+    struct Entry {
+        Shape* shape;
+        QRectF rect;
+    };
+
+    int cellOf(qreal coordinate) const { return qFloor(coordinate / cellSize); }
+
+    static quint64 cellKey(int x, int y) {
+        return (quint64(quint32(x)) << 32) | quint32(y);
+    }
+
+    template <typename Function>
+    void forEachCell(const QRectF& rect, Function function) const {
+        const int left = cellOf(rect.left());
+        const int right = cellOf(rect.right());
+        const int top = cellOf(rect.top());
+        const int bottom = cellOf(rect.bottom());
+        for (int y = top; y <= bottom; ++y) {
+            for (int x = left; x <= right; ++x) {
+                function(cellKey(x, y));
+            }
+        }
+    }
+
+    qreal cellSize;
+    QHash<quint64, QVector<Entry>> cells;
+    QRectF extent; // Не сжимается при удалении
+};
+
+// R-дерево с разбиением узла пополам вдоль оси наибольшего разброса
+class RTreeIndex : public SpatialIndex {
+public:
+    RTreeIndex() : root(new Node(true)) {}
+    ~RTreeIndex() override { deleteNode(root); }
+
+    SpatialIndexType type() const override { return SpatialIndexType::RTree; }
+
+    void insert(Shape* shape, const QRectF& rect) override {
+        Node* sibling = insertInto(root, Entry{ rect, nullptr, shape });
+        if (sibling) {
+            Node* newRoot = new Node(false);
+            newRoot->entries.append(Entry{ boxOf(root), root, nullptr });
+            newRoot->entries.append(Entry{ boxOf(sibling), sibling, nullptr });
+            root = newRoot;
+        }
+    }
+
+    void remove(Shape* shape, const QRectF& rect) override {
+        removeFrom(root, shape, rect);
+        while (!root->leaf && root->entries.size() == 1) {
+            Node* child = root->entries.first().child;
+            root->entries.clear();
+            delete root;
+            root = child;
+        }
+        if (!root->leaf && root->entries.isEmpty()) {
+            delete root;
+            root = new Node(true);
+        }
+    }
+
+    void clear() override {
+        deleteNode(root);
+        root = new Node(true);
+    }
+
+    void query(const QRectF& rect, QVector<Shape*>& result) const override {
+        queryNode(root, rect, result);
+    }
+
+    QRectF bounds() const override {
+        return root->entries.isEmpty() ? QRectF() : boxOf(root);
+    }
+
+private:
+    static const int maxEntries = 16;
+
+    struct Node;
+    struct Entry {
+        QRectF box;
+        Node* child;  // Внутренний узел
+        Shape* shape; // Лист
+    };
+    struct Node {
+        explicit Node(bool leaf) : leaf(leaf) {}
+        bool leaf;
+        QVector<Entry> entries;
+    };
+
+    static QRectF boxOf(const Node* node) {
+        QRectF box = node->entries.first().box;
+        for (const Entry& entry : node->entries) {
+            box = merged(box, entry.box);
+        }
+        return box;
+    }
+
+    static void deleteNode(Node* node) {
+        if (!node->leaf) {
+            for (const Entry& entry : node->entries) {
+                deleteNode(entry.child);
+            }
+        }
+        delete node;
+    }
+
+    // Возвращает новый соседний узел, если пришлось делить
+    Node* insertInto(Node* node, const Entry& entry) {
+        if (node->leaf) {
+            node->entries.append(entry);
+        } else {
+            int best = 0;
+            qreal bestGrowth = 0;
+            qreal bestArea = 0;
+            for (int i = 0; i < node->entries.size(); ++i) {
+                const QRectF& box = node->entries.at(i).box;
+                const qreal boxArea = area(box);
+                const qreal growth = area(merged(box, entry.box)) - boxArea;
+                if (i == 0 || growth < bestGrowth || (growth == bestGrowth && boxArea < bestArea)) {
+                    best = i;
+                    bestGrowth = growth;
+                    bestArea = boxArea;
+                }
+            }
+
+            Entry& target = node->entries[best];
+            Node* sibling = insertInto(target.child, entry);
+            target.box = merged(target.box, entry.box);
+            if (sibling) {
+                target.box = boxOf(target.child);
+                node->entries.append(Entry{ boxOf(sibling), sibling, nullptr });
+            }
+        }
+        return node->entries.size() > maxEntries ? split(node) : nullptr;
+    }
+
+    static Node* split(Node* node) {
+        QRectF box = boxOf(node);
+        const bool byX = box.width() >= box.height();
+        std::sort(node->entries.begin(), node->entries.end(), [byX](const Entry& a, const Entry& b) {
+            return byX ? a.box.center().x() < b.box.center().x()
+                       : a.box.center().y() < b.box.center().y();
+        });
+
+        Node* sibling = new Node(node->leaf);
+        const int half = node->entries.size() / 2;
+        sibling->entries = node->entries.mid(half);
+        node->entries.resize(half);
+        return sibling;
+    }
+
+    static bool removeFrom(Node* node, Shape* shape, const QRectF& rect) {
+        for (int i = 0; i < node->entries.size(); ++i) {
+            Entry& entry = node->entries[i];
+            if (node->leaf) {
+                if (entry.shape == shape) {
+                    node->entries.remove(i);
+                    return true;
+                }
+                continue;
+            }
+            if (!overlaps(entry.box, rect) || !removeFrom(entry.child, shape, rect))
+                continue;
+
+            // Опустевшие узлы выбрасываем, остальные ужимаем
+            if (entry.child->entries.isEmpty()) {
+                deleteNode(entry.child);
+                node->entries.remove(i);
+            } else {
+                entry.box = boxOf(entry.child);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    static void queryNode(const Node* node, const QRectF& rect, QVector<Shape*>& result) {
+        for (const Entry& entry : node->entries) {
+            if (!overlaps(entry.box, rect))
+                continue;
+            if (node->leaf) {
+                result.append(entry.shape);
+            } else {
+                queryNode(entry.child, rect, result);
+            }
+        }
+    }
+
+    Node* root;
+};
+}
+
+SpatialIndex* SpatialIndex::create(SpatialIndexType type) {
+    switch (type) {
+    case SpatialIndexType::Grid:
+        return new GridIndex;
+    case SpatialIndexType::RTree:
+    default:
+        return new RTreeIndex;
+    }
+}
+
+QVector<Shape*> SpatialIndex::nearest(const QPointF& pos, int k) const {
+    QVector<Shape*> result;
+    const QRectF extent = bounds();
+    if (k <= 0 || extent.isNull())
+        return result;
+
+    // Расширяем окно поиска, пока k-я найденная фигура не окажется внутри радиуса:
+    // всё, что дальше радиуса, ближе быть уже не может
+    const qreal limit = distanceTo(extent, pos) + qMax(extent.width(), extent.height());
+    QVector<Shape*> candidates;
+    QVector<QPair<qreal, Shape*>> ranked;
+    for (qreal radius = 64;; radius *= 2) {
+        candidates.clear();
+        query(QRectF(pos.x() - radius, pos.y() - radius, radius * 2, radius * 2), candidates);
+
+        ranked.clear();
+        for (Shape* shape : candidates) {
+            ranked.append(qMakePair(distanceTo(shape->sceneBoundingRect(), pos), shape));
+        }
+        std::sort(ranked.begin(), ranked.end(), [](const QPair<qreal, Shape*>& a,
+                                                   const QPair<qreal, Shape*>& b) {
+            return a.first < b.first;
+        });
+
+        if ((ranked.size() >= k && ranked.at(k - 1).first <= radius) || radius > limit)
+            break;
+    }
+
+    const int count = qMin(k, ranked.size());
+    result.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        result.append(ranked.at(i).second);
+    }
+    return result;
+}
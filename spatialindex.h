@@ -0,0 +1,32 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <QRectF>
+#include <QVector>
+
+class Shape;
+
+enum class SpatialIndexType { Grid, RTree };
+
+// Индекс ограничивающих прямоугольников фигур в координатах сцены.
+// Не ограничен областью сцены и растет вместе с содержимым.
+// Запросы возвращают кандидатов по прямоугольникам, точную проверку
+// по форме делает GraphicModel.
+class SpatialIndex {
+public:
+    virtual ~SpatialIndex() {}
+
+    static SpatialIndex* create(SpatialIndexType type);
+
+    virtual SpatialIndexType type() const = 0;
+    virtual void insert(Shape* shape, const QRectF& rect) = 0;
+    virtual void remove(Shape* shape, const QRectF& rect) = 0; // rect - тот, с которым вставляли
+    virtual void clear() = 0;
+    virtual void query(const QRectF& rect, QVector<Shape*>& result) const = 0;
+    virtual QRectF bounds() const = 0;
+
+    // k ближайших по расстоянию до прямоугольника, от ближнего к дальнему
+    QVector<Shape*> nearest(const QPointF& pos, int k) const;
+};
+
+#endif // SPATIALINDEX_H